@@ -0,0 +1,94 @@
+/**
+ * @file arena.hpp
+ * @brief Bump allocator whose memory is released all at once
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <vector>
+#include <stddef.h>
+#include <stdlib.h>
+
+
+
+/**
+ * @brief Allocates memory by advancing a pointer inside big blocks. The allocations aren't freed one by
+ * one: reset() makes the whole memory available again, keeping the blocks, so an arena which is reset
+ * regularly stops asking memory to the system once it reaches its biggest usage.
+ */
+class Arena{
+private:
+  static const size_t block_size = 1 << 16;
+  std::vector<char*> m_blocks;
+  std::vector<size_t> m_sizes;
+  size_t m_block;   // Block where the next allocation is tried
+  size_t m_used;    // Bytes used of that block
+  size_t m_bytes;   // Bytes allocated since the last reset
+
+public:
+
+  Arena(){
+    m_block = 0;
+    m_used = 0;
+    m_bytes = 0;
+  }
+
+  ~Arena(){
+    for (size_t i=0; i < m_blocks.size(); i++)
+      free(m_blocks[i]);
+  }
+
+  /**
+   * @brief Returns size bytes aligned to 8 bytes, which are valid until the next reset.
+   */
+  void* allocate(size_t size){
+    size = (size + 7) & ~(size_t)7;
+    while (m_block < m_blocks.size() && m_used + size > m_sizes[m_block]){
+      m_block++;
+      m_used = 0;
+    }
+    if (m_block == m_blocks.size()){
+      size_t new_size = size > block_size ? size : block_size;
+      m_blocks.push_back((char*)malloc(new_size));
+      m_sizes.push_back(new_size);
+      m_used = 0;
+    }
+    void* memory = m_blocks[m_block] + m_used;
+    m_used += size;
+    m_bytes += size;
+    return memory;
+  }
+
+  /**
+   * @brief Releases all the allocations.
+   */
+  void reset(){
+    m_block = 0;
+    m_used = 0;
+    m_bytes = 0;
+  }
+
+  /**
+   * @brief Returns the bytes allocated since the last reset.
+   */
+  size_t bytes() const{
+    return m_bytes;
+  }
+
+  /**
+   * @brief Returns the bytes reserved from the system.
+   */
+  size_t capacity() const{
+    size_t capacity = 0;
+    for (size_t i=0; i < m_sizes.size(); i++)
+      capacity += m_sizes[i];
+    return capacity;
+  }
+
+private:
+  Arena(const Arena&);
+  Arena& operator=(const Arena&);
+};
+
+#endif
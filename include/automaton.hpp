@@ -0,0 +1,1417 @@
+/**
+ * @file automaton.hpp
+ * @brief Finite automata which count the matches of the lex expressions generated by the training
+ */
+
+#ifndef _AUTOMATON_H_
+#define _AUTOMATON_H_
+
+#include <algorithm>
+#include <bitset>
+#include <map>
+#include <string>
+#include <vector>
+#include <utility>
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#ifdef DFA_HUGEPAGES
+#include <new>
+#include <stdlib.h>
+#include <sys/mman.h>
+#endif
+
+
+typedef std::bitset<256> CharSet;
+
+
+/**
+ * @brief Nondeterministic automaton (Thompson construction) of several regular expressions.
+ * It understands the subset of the lex syntax used by the training: quoted strings, character
+ * classes, escapes, ".", "(", ")", "|", "*", "+" and "?".
+ */
+class Nfa{
+public:
+  struct State{
+    int set;   // Index of the CharSet consumed by the transition, -1 for an epsilon transition
+    int out1;  // Next state, -1 if there isn't
+    int out2;  // Second epsilon transition, -1 if there isn't
+    int match; // Expression accepted in this state, -1 if none
+  };
+
+private:
+  std::vector<State> m_states;
+  std::vector<CharSet> m_sets;
+  std::vector<int> m_starts;
+  int m_regexs;
+
+  // Fragment of automaton with an unique final epsilon state
+  struct Fragment{
+    int start;
+    int end;
+  };
+
+  int addState(int set, int out1, int out2){
+    State state = {set, out1, out2, -1};
+    m_states.push_back(state);
+    return m_states.size()-1;
+  }
+
+  Fragment charFragment(const CharSet &set){
+    m_sets.push_back(set);
+    int end = addState(-1, -1, -1);
+    Fragment f = {addState(m_sets.size()-1, end, -1), end};
+    return f;
+  }
+
+  Fragment emptyFragment(){
+    int end = addState(-1, -1, -1);
+    Fragment f = {addState(-1, end, -1), end};
+    return f;
+  }
+
+  Fragment concat(const Fragment &f1, const Fragment &f2){
+    m_states[f1.end].out1 = f2.start;
+    Fragment f = {f1.start, f2.end};
+    return f;
+  }
+
+  static int hexValue(char c){
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+
+  // Reads the escape sequence which starts after the backslash at pos, as flex does.
+  static unsigned char escape(const std::string &str, size_t &pos){
+    char c = str[pos++];
+    switch (c){
+      case 'n': return '\n';
+      case 't': return '\t';
+      case 'r': return '\r';
+      case 'f': return '\f';
+      case 'v': return '\v';
+      case 'a': return '\a';
+      case 'b': return '\b';
+      case 'x': {
+        int value = 0, digits = 0;
+        while (digits < 2 && pos < str.size() && hexValue(str[pos]) >= 0){
+          value = value*16 + hexValue(str[pos++]);
+          digits++;
+        }
+        return digits > 0 ? value : 'x';
+      }
+    }
+    if (c >= '0' && c <= '7'){
+      int value = c - '0', digits = 1;
+      while (digits < 3 && pos < str.size() && str[pos] >= '0' && str[pos] <= '7'){
+        value = value*8 + str[pos++] - '0';
+        digits++;
+      }
+      return value;
+    }
+    return c;
+  }
+
+  bool parseClass(const std::string &str, size_t &pos, CharSet &set){
+    bool negated = false;
+    int prev = -1;
+    set.reset();
+    if (pos < str.size() && str[pos] == '^'){
+      negated = true;
+      pos++;
+    }
+    bool first = true;
+    while (pos < str.size() && (str[pos] != ']' || first)){
+      first = false;
+      int c = (unsigned char)str[pos++];
+      if (c == '\\' && pos < str.size())
+        c = escape(str, pos);
+      else if (c == '-' && prev >= 0 && pos < str.size() && str[pos] != ']'){
+        int last = (unsigned char)str[pos++];
+        if (last == '\\' && pos < str.size())
+          last = escape(str, pos);
+        for (int i=prev; i <= last; i++)
+          set.set(i);
+        prev = -1;
+        continue;
+      }
+      set.set(c);
+      prev = c;
+    }
+    if (pos >= str.size())
+      return false;
+    pos++;
+    if (negated)
+      set.flip();
+    return true;
+  }
+
+  bool parseAlternation(const std::string &str, size_t &pos, int depth, Fragment &f);
+
+  bool parseSingle(const std::string &str, size_t &pos, int depth, Fragment &f){
+    CharSet set;
+    char c = str[pos++];
+    switch (c){
+      case '(':
+        if (!parseAlternation(str, pos, depth+1, f) || pos >= str.size() || str[pos] != ')')
+          return false;
+        pos++;
+        return true;
+      case '"':
+        f = emptyFragment();
+        while (pos < str.size() && str[pos] != '"'){
+          unsigned char character = str[pos++];
+          if (character == '\\' && pos < str.size())
+            character = escape(str, pos);
+          set.reset();
+          set.set(character);
+          f = concat(f, charFragment(set));
+        }
+        if (pos >= str.size())
+          return false;
+        pos++;
+        return true;
+      case '[':
+        if (!parseClass(str, pos, set))
+          return false;
+        f = charFragment(set);
+        return true;
+      case '.':
+        set.set();
+        set.reset('\n');
+        f = charFragment(set);
+        return true;
+      case '\\':
+        if (pos >= str.size())
+          return false;
+        set.set(escape(str, pos));
+        f = charFragment(set);
+        return true;
+      case '{': case '}': case '*': case '+': case '?':
+        return false;
+    }
+    set.set((unsigned char)c);
+    f = charFragment(set);
+    return true;
+  }
+
+  bool parseRepetition(const std::string &str, size_t &pos, int depth, Fragment &f){
+    if (!parseSingle(str, pos, depth, f))
+      return false;
+    while (pos < str.size() && (str[pos] == '*' || str[pos] == '+' || str[pos] == '?')){
+      int end = addState(-1, -1, -1);
+      switch (str[pos++]){
+        case '*': {
+          int split = addState(-1, f.start, end);
+          m_states[f.end].out1 = split;
+          f.start = split;
+          break;
+        }
+        case '+':
+          m_states[f.end].out1 = addState(-1, f.start, end);
+          break;
+        case '?':
+          m_states[f.end].out1 = end;
+          f.start = addState(-1, f.start, end);
+          break;
+      }
+      f.end = end;
+    }
+    return true;
+  }
+
+  static bool endsConcatenation(char c){
+    return c == '|' || c == ')' || isspace((unsigned char)c);
+  }
+
+  bool parseConcatenation(const std::string &str, size_t &pos, int depth, Fragment &f){
+    Fragment next;
+    f = emptyFragment();
+    while (pos < str.size() && !endsConcatenation(str[pos])){
+      if (!parseRepetition(str, pos, depth, next))
+        return false;
+      f = concat(f, next);
+    }
+    return true;
+  }
+
+public:
+
+  /**
+   * @brief Builds an automaton without expressions.
+   */
+  Nfa(){
+    m_regexs = 0;
+  }
+
+  /**
+   * @brief Adds an expression to the automaton. Its matches will be reported with the index
+   * of the expression (the number of expressions added before it).
+   * @param regex Expression in lex syntax. Like in a lex rule, the expression ends at the
+   * first whitespace which isn't quoted.
+   * @return false if the expression can't be parsed. In that case it never matches.
+   */
+  bool addRegex(const std::string &regex){
+    size_t pos = 0;
+    Fragment f;
+    int id = m_regexs++;
+    bool ok = parseAlternation(regex, pos, 0, f) && (pos == regex.size() || isspace((unsigned char)regex[pos]));
+    if (!ok)
+      return false;
+    m_states[f.end].match = id;
+    m_starts.push_back(f.start);
+    return true;
+  }
+
+  /**
+   * @brief Returns the number of expressions added to the automaton.
+   */
+  int regexs() const{
+    return m_regexs;
+  }
+
+  const std::vector<State>& states() const{
+    return m_states;
+  }
+
+  const std::vector<CharSet>& sets() const{
+    return m_sets;
+  }
+
+  /**
+   * @brief Returns the start state of each expression which could be parsed.
+   */
+  const std::vector<int>& starts() const{
+    return m_starts;
+  }
+
+  /**
+   * @brief Obtains the states reachable with epsilon transitions from the states of a stack, keeping only
+   * the ones which consume characters or accept, since they are the only ones which tell apart two subsets.
+   * @param stack States from which the closure starts. It's emptied.
+   * @param visited Array of states() elements, where the visited states are marked with stamp.
+   * @param stamp Value which no state of visited has yet.
+   * @param set Sorted states of the closure.
+   */
+  void closure(std::vector<int> &stack, std::vector<int> &visited, int stamp, std::vector<int> &set) const{
+    set.clear();
+    while (!stack.empty()){
+      int s = stack.back();
+      stack.pop_back();
+      if (s < 0 || visited[s] == stamp)
+        continue;
+      visited[s] = stamp;
+      if (m_states[s].set >= 0 || m_states[s].match >= 0)
+        set.push_back(s);
+      if (m_states[s].set < 0){
+        stack.push_back(m_states[s].out1);
+        stack.push_back(m_states[s].out2);
+      }
+    }
+    std::sort(set.begin(), set.end());
+  }
+};
+
+
+inline bool Nfa::parseAlternation(const std::string &str, size_t &pos, int depth, Fragment &f){
+  Fragment next;
+  if (!parseConcatenation(str, pos, depth, f))
+    return false;
+  while (pos < str.size() && str[pos] == '|'){
+    pos++;
+    if (!parseConcatenation(str, pos, depth, next))
+      return false;
+    int end = addState(-1, -1, -1);
+    m_states[f.end].out1 = end;
+    m_states[next.end].out1 = end;
+    f.start = addState(-1, f.start, next.start);
+    f.end = end;
+  }
+  if (pos < str.size() && str[pos] == ')' && depth == 0)
+    return false;
+  return true;
+}
+
+
+#ifdef DFA_HUGEPAGES
+/**
+ * @brief Allocator of the transition tables which backs the tables of 2MB or more with huge pages, so
+ * scanning a big automaton doesn't miss the TLB at every transition.
+ */
+template <class T>
+struct TableAllocator{
+  typedef T value_type;
+  static const size_t huge_page = 1 << 21;
+
+  TableAllocator(){}
+  template <class U> TableAllocator(const TableAllocator<U>&){}
+
+  T* allocate(size_t n){
+    size_t bytes = n * sizeof(T);
+    void* memory = NULL;
+    if (bytes >= huge_page){
+      bytes = (bytes + huge_page - 1) & ~(huge_page - 1);
+      if (posix_memalign(&memory, huge_page, bytes) != 0)
+        throw std::bad_alloc();
+      madvise(memory, bytes, MADV_HUGEPAGE);
+    } else if ((memory = malloc(bytes)) == NULL)
+      throw std::bad_alloc();
+    return (T*)memory;
+  }
+
+  void deallocate(T* memory, size_t){
+    free(memory);
+  }
+};
+
+template <class T, class U> bool operator==(const TableAllocator<T>&, const TableAllocator<U>&){ return true; }
+template <class T, class U> bool operator!=(const TableAllocator<T>&, const TableAllocator<U>&){ return false; }
+
+typedef std::vector<int, TableAllocator<int> > TransitionTable;
+#else
+typedef std::vector<int> TransitionTable;
+#endif
+
+
+/**
+ * @brief Deterministic automaton obtained with the subset construction from a Nfa. Each state
+ * keeps the list of the expressions which match when it is reached. The state 0 is the dead state.
+ * The bytes which lead every state to the same state share a class, so the transitions are stored per
+ * class instead of per byte. The table is dense or, when it doesn't fit in the L1 cache and most of its
+ * transitions go to the dead state, packed with row displacement: each row is placed at the first offset
+ * where its live transitions don't collide with the ones already placed, so sparse rows fill the holes of
+ * the dense ones.
+ */
+class Dfa{
+private:
+  TransitionTable m_next;          // Dense layout: m_next[m_class_count*state + class]
+  TransitionTable m_comb_next;     // Row displacement layout: the transition of state s with class c is
+  TransitionTable m_comb_check;    // m_comb_next[m_comb_base[s] + c] if m_comb_check[m_comb_base[s] + c] == s
+  std::vector<int> m_comb_base;
+  unsigned char m_classes[256];
+  int m_class_count;
+  int m_states;
+  std::vector<int> m_match_first; // The matches of a state are in [m_match_first[s], m_match_first[s+1])
+  std::vector<int> m_match_ids;
+  int m_start;
+
+  static const size_t dense_limit = 32 << 10; // Bytes of a dense table which are kept in L1
+
+  /**
+   * @brief Stores a table of transitions, grouping its columns in classes and choosing the layout.
+   * @param next next[width*state + column], with m_states rows.
+   * @param columns Column of each byte.
+   */
+  void setTable(const std::vector<int> &next, int width, const unsigned char* columns){
+    // Columns with the same hash are compared entirely, so equal columns always share a class
+    std::vector<uint64_t> hashes(width, 0);
+    for (int s=0; s < m_states; s++)
+      for (int c=0; c < width; c++)
+        hashes[c] = (hashes[c] ^ (uint64_t)next[width*s + c]) * 0x100000001b3ULL;
+    std::vector<int> column_class(width, -1), class_column;
+    std::map<uint64_t, std::vector<int> > representatives;
+    for (int c=0; c < width; c++){
+      std::vector<int> &candidates = representatives[hashes[c]];
+      for (size_t i=0; i < candidates.size() && column_class[c] < 0; i++){
+        int s = 0, r = class_column[candidates[i]];
+        while (s < m_states && next[width*s + c] == next[width*s + r])
+          s++;
+        if (s == m_states)
+          column_class[c] = candidates[i];
+      }
+      if (column_class[c] < 0){
+        column_class[c] = class_column.size();
+        candidates.push_back(class_column.size());
+        class_column.push_back(c);
+      }
+    }
+    m_class_count = class_column.size();
+    for (int b=0; b < 256; b++)
+      m_classes[b] = column_class[columns[b]];
+
+    std::vector<int> dense(m_states * m_class_count);
+    size_t live = 0;
+    for (int s=0; s < m_states; s++)
+      for (int c=0; c < m_class_count; c++){
+        dense[m_class_count*s + c] = next[width*s + class_column[c]];
+        live += dense[m_class_count*s + c] != 0;
+      }
+    m_next.clear();
+    m_comb_next.clear();
+    m_comb_check.clear();
+    m_comb_base.clear();
+    // Each live transition of the packed table takes two entries, so it only pays off if most are dead
+    if (dense.size() * sizeof(int) <= dense_limit || 4 * live > dense.size() || !pack(dense))
+      m_next.assign(dense.begin(), dense.end());
+  }
+
+  /**
+   * @brief Packs a dense table with row displacement, placing first the rows with more live transitions.
+   * @return false if the packed table isn't smaller than half the dense one.
+   */
+  bool pack(const std::vector<int> &dense){
+    std::vector<std::pair<int, int> > rows;
+    for (int s=0; s < m_states; s++){
+      int live = 0;
+      for (int c=0; c < m_class_count; c++)
+        live += dense[m_class_count*s + c] != 0;
+      rows.push_back(std::pair<int, int>(-live, s));
+    }
+    std::sort(rows.begin(), rows.end());
+    m_comb_base.assign(m_states, 0);
+    m_comb_check.assign(m_class_count, -1);
+    m_comb_next.assign(m_class_count, 0);
+    size_t first_free = 0;
+    for (size_t r=0; r < rows.size() && rows[r].first < 0; r++){
+      int s = rows[r].second;
+      const int* row = &dense[m_class_count*s];
+      while (first_free < m_comb_check.size() && m_comb_check[first_free] >= 0)
+        first_free++;
+      for (size_t base = first_free >= (size_t)m_class_count ? first_free - m_class_count + 1 : 0; ; base++){
+        if (base + m_class_count > m_comb_check.size()){
+          m_comb_check.resize(base + m_class_count, -1);
+          m_comb_next.resize(base + m_class_count, 0);
+        }
+        int c = 0;
+        while (c < m_class_count && (row[c] == 0 || m_comb_check[base + c] < 0))
+          c++;
+        if (c < m_class_count)
+          continue;
+        m_comb_base[s] = base;
+        for (c=0; c < m_class_count; c++)
+          if (row[c] != 0){
+            m_comb_check[base + c] = s;
+            m_comb_next[base + c] = row[c];
+          }
+        break;
+      }
+    }
+    if ((m_comb_next.size() + m_comb_check.size() + m_comb_base.size()) * 2 < dense.size())
+      return true;
+    m_comb_next.clear();
+    m_comb_check.clear();
+    m_comb_base.clear();
+    return false;
+  }
+
+public:
+
+  /**
+   * @brief Builds an automaton with only the dead state.
+   */
+  Dfa(){
+    unsigned char columns[256] = {0};
+    m_states = 1;
+    m_match_first.assign(2, 0);
+    m_start = 0;
+    setTable(std::vector<int>(1, 0), 1, columns);
+  }
+
+  /**
+   * @brief Builds the deterministic automaton of all the expressions of nfa.
+   * @param nfa Automaton to determinize.
+   * @param max_states Maximum number of states. The construction is aborted if it's exceeded.
+   * @return false if the automaton would have more than max_states states.
+   */
+  bool build(const Nfa &nfa, int max_states){
+    const std::vector<Nfa::State> &nfa_states = nfa.states();
+    const std::vector<CharSet> &sets = nfa.sets();
+    std::map<std::vector<int>, int> ids;
+    std::vector<std::vector<int> > subsets;
+    std::vector<int> stack, visited(nfa_states.size(), -1), set;
+    std::vector<std::vector<int> > targets(256);
+    std::vector<int> next(256, 0);
+    int stamp = 0;
+
+    m_match_first.assign(1, 0);
+    m_match_ids.clear();
+    subsets.push_back(std::vector<int>());
+    ids[subsets[0]] = 0;
+
+    stack = nfa.starts();
+    nfa.closure(stack, visited, stamp++, set);
+    m_start = 1;
+    ids[set] = 1;
+    subsets.push_back(set);
+    next.resize(2*256, 0);
+
+    for (size_t s=0; s < subsets.size(); s++){
+      std::vector<int> matches;
+      for (size_t i=0; i < subsets[s].size(); i++){
+        const Nfa::State &state = nfa_states[subsets[s][i]];
+        if (state.match >= 0)
+          matches.push_back(state.match);
+      }
+      std::sort(matches.begin(), matches.end());
+      matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+      m_match_ids.insert(m_match_ids.end(), matches.begin(), matches.end());
+      m_match_first.push_back(m_match_ids.size());
+
+      if (s == 0)
+        continue;
+      for (int c=0; c < 256; c++)
+        targets[c].clear();
+      for (size_t i=0; i < subsets[s].size(); i++){
+        const Nfa::State &state = nfa_states[subsets[s][i]];
+        if (state.set < 0)
+          continue;
+        const CharSet &chars = sets[state.set];
+        for (int c=0; c < 256; c++)
+          if (chars[c])
+            targets[c].push_back(state.out1);
+      }
+      std::map<std::vector<int>, int> solved; // Many bytes share the same targets
+      for (int c=0; c < 256; c++){
+        std::map<std::vector<int>, int>::iterator it = solved.find(targets[c]);
+        if (it != solved.end()){
+          next[256*s + c] = it->second;
+          continue;
+        }
+        stack = targets[c];
+        nfa.closure(stack, visited, stamp++, set);
+        std::map<std::vector<int>, int>::iterator id = ids.find(set);
+        int target;
+        if (id != ids.end())
+          target = id->second;
+        else {
+          if ((int)subsets.size() >= max_states)
+            return false;
+          target = subsets.size();
+          ids[set] = target;
+          subsets.push_back(set);
+          next.resize(subsets.size()*256, 0);
+        }
+        solved[targets[c]] = target;
+        next[256*s + c] = target;
+      }
+    }
+
+    unsigned char columns[256];
+    for (int b=0; b < 256; b++)
+      columns[b] = b;
+    m_states = subsets.size();
+    setTable(next, 256, columns);
+    return true;
+  }
+
+  /**
+   * @brief Merges the states which match the same expressions after every input (Hopcroft's algorithm
+   * over the byte classes), so the automaton counts the same matches with the fewest states. The states
+   * which can't lead to a match become the dead state.
+   */
+  void minimize(){
+    int n = m_states, k = m_class_count;
+    std::vector<int> next(n * k);
+    for (int s=0; s < n; s++)
+      for (int c=0; c < k; c++)
+        next[k*s + c] = classNext(s, c);
+
+    // Predecessors of each state by each class: preds[pred_first[k*t + c], pred_first[k*t + c + 1])
+    std::vector<int> pred_first(n*k + 1, 0), preds(n*k);
+    for (int s=0; s < n; s++)
+      for (int c=0; c < k; c++)
+        pred_first[k*next[k*s + c] + c + 1]++;
+    for (int i=0; i < n*k; i++)
+      pred_first[i+1] += pred_first[i];
+    std::vector<int> fill(pred_first.begin(), pred_first.end() - 1);
+    for (int s=0; s < n; s++)
+      for (int c=0; c < k; c++)
+        preds[fill[k*next[k*s + c] + c]++] = s;
+
+    // The blocks are ranges of elements; the marked states of a block are moved to its beginning
+    std::vector<int> elements(n), location(n), block_of(n), first, end, marked;
+    std::map<std::vector<int>, int> signatures;
+    for (int s=0; s < n; s++){
+      std::vector<int> signature(m_match_ids.begin() + m_match_first[s], m_match_ids.begin() + m_match_first[s+1]);
+      std::map<std::vector<int>, int>::iterator it = signatures.find(signature);
+      if (it == signatures.end()){
+        it = signatures.insert(std::pair<std::vector<int>, int>(signature, first.size())).first;
+        first.push_back(0);
+        end.push_back(0);
+      }
+      block_of[s] = it->second;
+      end[it->second]++;
+    }
+    int blocks = first.size(), largest = 0, largest_size = 0;
+    for (int b=0, position=0; b < blocks; b++){
+      int size = end[b];
+      first[b] = end[b] = position;
+      position += size;
+      if (size > largest_size){
+        largest = b;
+        largest_size = size;
+      }
+    }
+    for (int s=0; s < n; s++){
+      location[s] = end[block_of[s]]++;
+      elements[location[s]] = s;
+    }
+    marked = first;
+    first.reserve(n);
+    end.reserve(n);
+    marked.reserve(n);
+
+    std::vector<std::pair<int, int> > work;
+    std::vector<char> in_work(n * k, 0);
+    for (int b=0; b < blocks; b++)
+      if (b != largest)
+        for (int c=0; c < k; c++){
+          work.push_back(std::pair<int, int>(b, c));
+          in_work[k*b + c] = 1;
+        }
+    std::vector<int> splitter, touched;
+    while (!work.empty()){
+      int a = work.back().first, c = work.back().second;
+      work.pop_back();
+      in_work[k*a + c] = 0;
+      splitter.assign(elements.begin() + first[a], elements.begin() + end[a]);
+      touched.clear();
+      for (size_t i=0; i < splitter.size(); i++)
+        for (int j=pred_first[k*splitter[i] + c]; j < pred_first[k*splitter[i] + c + 1]; j++){
+          int p = preds[j], y = block_of[p];
+          if (location[p] < marked[y])
+            continue;
+          if (marked[y] == first[y])
+            touched.push_back(y);
+          int other = elements[marked[y]];
+          std::swap(elements[location[p]], elements[marked[y]]);
+          location[other] = location[p];
+          location[p] = marked[y]++;
+        }
+      for (size_t i=0; i < touched.size(); i++){
+        int y = touched[i];
+        if (marked[y] == end[y]){
+          marked[y] = first[y];
+          continue;
+        }
+        int z = blocks++;
+        first.push_back(first[y]);
+        end.push_back(marked[y]);
+        marked.push_back(first[y]);
+        first[y] = marked[y];
+        for (int j=first[z]; j < end[z]; j++)
+          block_of[elements[j]] = z;
+        for (int d=0; d < k; d++)
+          if (in_work[k*y + d] || end[z] - first[z] <= end[y] - first[y]){
+            work.push_back(std::pair<int, int>(z, d));
+            in_work[k*z + d] = 1;
+          } else {
+            work.push_back(std::pair<int, int>(y, d));
+            in_work[k*y + d] = 1;
+          }
+      }
+    }
+
+    // The block of the dead state keeps the number 0
+    std::vector<int> ids(blocks, -1);
+    ids[block_of[0]] = 0;
+    int states = 1;
+    for (int s=0; s < n; s++)
+      if (ids[block_of[s]] < 0)
+        ids[block_of[s]] = states++;
+    std::vector<int> new_next(states * k), new_match_first(1, 0), new_match_ids;
+    std::vector<int> representative(states);
+    for (int s=n-1; s >= 0; s--)
+      representative[ids[block_of[s]]] = s;
+    for (int s=0; s < states; s++){
+      int r = representative[s];
+      for (int c=0; c < k; c++)
+        new_next[k*s + c] = ids[block_of[next[k*r + c]]];
+      new_match_ids.insert(new_match_ids.end(), m_match_ids.begin() + m_match_first[r], m_match_ids.begin() + m_match_first[r+1]);
+      new_match_first.push_back(new_match_ids.size());
+    }
+    unsigned char columns[256];
+    for (int b=0; b < 256; b++)
+      columns[b] = m_classes[b];
+    m_start = ids[block_of[m_start]];
+    m_states = states;
+    m_match_first.swap(new_match_first);
+    m_match_ids.swap(new_match_ids);
+    setTable(new_next, k, columns);
+  }
+
+  /**
+   * @brief Returns the number of states, the dead one included.
+   */
+  int states() const{
+    return m_states;
+  }
+
+  int start() const{
+    return m_start;
+  }
+
+  /**
+   * @brief Returns the state reached from s reading a byte of class c.
+   */
+  int classNext(int s, int c) const{
+    if (m_comb_base.empty())
+      return m_next[m_class_count*s + c];
+    int i = m_comb_base[s] + c;
+    return m_comb_check[i] == s ? m_comb_next[i] : 0;
+  }
+
+  /**
+   * @brief Returns the state reached from s reading the byte c.
+   */
+  int next(int s, unsigned char c) const{
+    return classNext(s, m_classes[c]);
+  }
+
+  /**
+   * @brief Returns the class of each byte.
+   */
+  const unsigned char* classes() const{
+    return m_classes;
+  }
+
+  int classCount() const{
+    return m_class_count;
+  }
+
+  /**
+   * @brief Returns whether the transitions are packed with row displacement instead of a dense table.
+   */
+  bool packed() const{
+    return !m_comb_base.empty();
+  }
+
+  /**
+   * @brief Returns the dense table, indexed by classCount()*state + class, or NULL if the table is packed.
+   */
+  const int* denseTransitions() const{
+    return packed() ? 0 : &m_next[0];
+  }
+
+  const int* combNext() const{
+    return packed() ? &m_comb_next[0] : 0;
+  }
+
+  const int* combCheck() const{
+    return packed() ? &m_comb_check[0] : 0;
+  }
+
+  const int* combBase() const{
+    return packed() ? &m_comb_base[0] : 0;
+  }
+
+  /**
+   * @brief Returns the bytes of the transition tables.
+   */
+  size_t tableBytes() const{
+    return sizeof(m_classes) + sizeof(int) * (m_next.size() + m_comb_next.size() + m_comb_check.size() + m_comb_base.size());
+  }
+
+  const int* matchFirst() const{
+    return &m_match_first[0];
+  }
+
+  const int* matchIds() const{
+    return m_match_ids.empty() ? 0 : &m_match_ids[0];
+  }
+};
+
+
+/**
+ * @brief Counts the matches of the expressions of a Dfa in the same way that a lex scanner whose rules
+ * end with REJECT does: every pair of start and end positions delimiting a match of an expression counts.
+ * Instead of restarting the automaton at every position it keeps how many start positions are in each
+ * state, so the work per byte is bounded by the number of states and the memory doesn't depend on the input.
+ * Only the active states and the counts belong to a counter; the space used while feeding is shared by all
+ * the counters of a thread, so many counters (streams) can be kept at the same time.
+ */
+class MatchCounter{
+public:
+  /**
+   * @brief Maximum number of streams which feedStreams scans at once.
+   */
+  static const int max_streams = 16;
+
+private:
+  typedef std::pair<int, uint64_t> ActiveState;
+  typedef std::vector<ActiveState> ActiveStates;
+
+  // Space used by feed, shared by the counters of each thread, with one per stream fed at once. The arrays of
+  // active states have room for all the states, so the scan fills them without the bookkeeping of a vector
+  struct Scratch{
+    std::vector<int> slot;
+    ActiveStates active;
+    ActiveStates next_active;
+  };
+
+  // A stream being fed, whose active states are in the arrays of its scratch
+  struct Lane{
+    MatchCounter* counter;
+    const unsigned char* data;
+    size_t length;
+    ActiveState* active;
+    ActiveState* next_active;
+    int* slot;
+    int active_size;
+    uint64_t* counts;
+    uint64_t steps;
+  };
+
+  const Dfa* m_dfa;
+  ActiveStates m_active;
+  std::vector<uint64_t> m_counts;
+  uint64_t m_steps;
+
+  static Scratch& scratch(int states, int lane){
+    static thread_local std::vector<Scratch> scratches(max_streams);
+    Scratch &scratch = scratches[lane];
+    if ((int)scratch.slot.size() < states){
+      scratch.slot.assign(states, -1);
+      scratch.active.resize(states);
+      scratch.next_active.resize(states);
+    }
+    return scratch;
+  }
+
+  // Transitions of each layout of the Dfa tables, by state and byte class
+  struct DenseNext{
+    const int* table;
+    int classes;
+    int operator()(int s, int c) const{
+      return table[classes*s + c];
+    }
+  };
+
+  struct PackedNext{
+    const int* next;
+    const int* check;
+    const int* base;
+    int operator()(int s, int c) const{
+      int i = base[s] + c;
+      return check[i] == s ? next[i] : 0;
+    }
+  };
+
+  void open(Lane &lane, const char* data, size_t length, int index){
+    Scratch &space = scratch(m_dfa->states(), index);
+    lane.counter = this;
+    lane.data = (const unsigned char*)data;
+    lane.length = length;
+    lane.active = &space.active[0];
+    lane.next_active = &space.next_active[0];
+    lane.slot = &space.slot[0];
+    lane.active_size = m_active.size();
+    lane.counts = m_counts.empty() ? 0 : &m_counts[0];
+    lane.steps = 0;
+    std::copy(m_active.begin(), m_active.end(), lane.active);
+  }
+
+  static void close(Lane &lane){
+    lane.counter->m_active.assign(lane.active, lane.active + lane.active_size);
+    lane.counter->m_steps += lane.steps;
+  }
+
+  template <class Next>
+  static inline void step(Lane &lane, int c, int start, const Next &next, const int* match_first, const int* match_ids){
+    ActiveState* active = lane.active;
+    ActiveState* next_active = lane.next_active;
+    int* slot = lane.slot;
+    int active_size = lane.active_size;
+    int next_size = 0;
+    lane.steps += active_size + 1;
+    int t = next(start, c);
+    if (t != 0){
+      slot[t] = 0;
+      next_active[next_size++] = ActiveState(t, 1);
+    }
+    for (int j=0; j < active_size; j++){
+      t = next(active[j].first, c);
+      if (t == 0)
+        continue;
+      if (slot[t] < 0){
+        slot[t] = next_size;
+        next_active[next_size++] = ActiveState(t, active[j].second);
+      } else
+        next_active[slot[t]].second += active[j].second;
+    }
+    for (int j=0; j < next_size; j++){
+      t = next_active[j].first;
+      slot[t] = -1;
+      for (int m=match_first[t]; m < match_first[t+1]; m++)
+        lane.counts[match_ids[m]] += next_active[j].second;
+    }
+    lane.active = next_active;
+    lane.next_active = active;
+    lane.active_size = next_size;
+  }
+
+  /**
+   * @brief Feeds every lane its data, a byte of each lane in turn. The lanes which end are dropped and the
+   * rest go on.
+   */
+  template <class Next>
+  static void scan(Lane* lanes, int lanes_num, const Next &next){
+    const Dfa* dfa = lanes[0].counter->m_dfa;
+    const unsigned char* classes = dfa->classes();
+    const int* match_first = dfa->matchFirst();
+    const int* match_ids = dfa->matchIds();
+    int start = dfa->start();
+    size_t done = 0;
+    while (lanes_num > 0){
+      size_t common = lanes[0].length;
+      for (int l=1; l < lanes_num; l++)
+        common = std::min(common, lanes[l].length);
+      if (lanes_num == 1){
+        for (size_t i=done; i < common; i++)
+          step(lanes[0], classes[lanes[0].data[i]], start, next, match_first, match_ids);
+      } else {
+        for (size_t i=done; i < common; i++)
+          for (int l=0; l < lanes_num; l++)
+            step(lanes[l], classes[lanes[l].data[i]], start, next, match_first, match_ids);
+      }
+      done = common;
+      int kept = 0;
+      for (int l=0; l < lanes_num; l++)
+        if (lanes[l].length > done)
+          lanes[kept++] = lanes[l];
+        else
+          close(lanes[l]);
+      lanes_num = kept;
+    }
+  }
+
+  /**
+   * @brief Opens a lane for each stream and scans them with the table layout of the Dfa.
+   */
+  static void feed(MatchCounter* const* counters, const char* const* data, const size_t* lengths, int streams){
+    Lane lanes[max_streams];
+    for (int l=0; l < streams; l++)
+      counters[l]->open(lanes[l], data[l], lengths[l], l);
+    const Dfa* dfa = counters[0]->m_dfa;
+    if (dfa->packed()){
+      PackedNext next = {dfa->combNext(), dfa->combCheck(), dfa->combBase()};
+      scan(lanes, streams, next);
+    } else {
+      DenseNext next = {dfa->denseTransitions(), dfa->classCount()};
+      scan(lanes, streams, next);
+    }
+  }
+
+public:
+
+  MatchCounter(){
+    m_dfa = 0;
+    m_steps = 0;
+  }
+
+  /**
+   * @brief Prepares the counter to count the matches of a new input with dfa. The memory is only
+   * allocated when the automaton has more expressions than the previous one.
+   * @param dfa Automaton whose expressions are counted.
+   * @param regexs Number of expressions of the automaton.
+   */
+  void reset(const Dfa &dfa, int regexs){
+    m_dfa = &dfa;
+    m_active.clear();
+    m_counts.assign(regexs, 0);
+    m_steps = 0;
+  }
+
+  /**
+   * @brief Counts the matches which end in data. Matches which start in a previous call are also counted.
+   */
+  void feed(const char* data, size_t length){
+    MatchCounter* counter = this;
+    feed(&counter, &data, &length, 1);
+  }
+
+  /**
+   * @brief Feeds several counters of the same Dfa at once, like calling feed on each of them, a byte of each
+   * stream in turn. It's an experiment: the scan isn't bound by the latency of the table lookups, and it has
+   * measured about twice slower than feeding the counters one by one (make bench, count_matches_dfa_streams*).
+   * @param counters Counters to feed, at most max_streams, all reset with the same automaton.
+   * @param data Data of each counter.
+   * @param lengths Length of the data of each counter.
+   * @param streams Number of counters.
+   */
+  static void feedStreams(MatchCounter* const* counters, const char* const* data, const size_t* lengths, int streams){
+    for (int first=0; first < streams; first += max_streams)
+      feed(counters + first, data + first, lengths + first, std::min(streams - first, (int)max_streams));
+  }
+
+  /**
+   * @brief Returns the number of matches of each expression counted since the last reset.
+   */
+  const std::vector<uint64_t>& counts() const{
+    return m_counts;
+  }
+
+  /**
+   * @brief Returns the transitions followed since the last reset: one from the start state and one from
+   * each active state for every byte. It measures the work of the scan, which is the same for every machine.
+   */
+  uint64_t steps() const{
+    return m_steps;
+  }
+
+  /**
+   * @brief Returns the number of states in which there are partial matches.
+   */
+  size_t activeStates() const{
+    return m_active.size();
+  }
+};
+
+
+/**
+ * @brief Counts the matches of the expressions of a Nfa like MatchCounter, but the states of the deterministic
+ * automaton are only built when the input reaches them, and kept in a cache of a bounded number of states.
+ * When the cache is full it's emptied, keeping only the states where the input is. If it fills again before
+ * the input advances thrash_bytes bytes per state, the automaton doesn't fit in the cache, so until the next
+ * reset the Nfa is stepped from the subsets where the input is, merging the equal ones, without building states.
+ * The expressions whose automaton fits are counted at the speed of a Dfa and none of them takes more memory than
+ * the cache, besides the states where the input is. The cache is kept between inputs.
+ */
+class LazyCounter{
+private:
+  typedef std::pair<int, uint64_t> ActiveState;
+
+  Nfa m_nfa;
+  int m_max_states;
+  unsigned char m_classes[256];
+  unsigned char m_class_bytes[256]; // A byte of each class
+  int m_class_count;
+  std::vector<int> m_start_subset;
+  int m_start;
+  std::vector<std::vector<int> > m_subsets; // Nfa states of each cached state. The state 0 is the dead state
+  std::map<std::vector<int>, int> m_ids;
+  std::vector<int> m_next;                  // m_next[m_class_count*state + class], -1 if it isn't built yet
+  std::vector<int> m_match_first;           // The matches of a state are in [m_match_first[s], m_match_first[s+1])
+  std::vector<int> m_match_ids;
+  std::vector<int> m_slot;
+  std::vector<int> m_stack;
+  std::vector<int> m_visited;
+  std::vector<int> m_set;
+  int m_stamp;
+  std::vector<ActiveState> m_active;      // The first m_active_size are the states where the input is
+  std::vector<ActiveState> m_next_active;
+  int m_active_size;
+  std::vector<uint64_t> m_counts;
+  uint64_t m_steps;
+  uint64_t m_fill_bytes; // Bytes scanned since the cache was last emptied
+  uint64_t m_flushes;
+  bool m_stepping;
+  // While stepping, the subsets where the input is, with their start positions, and the table which merges the
+  // equal subsets reached in a step. The subsets keep their capacity, so stepping doesn't allocate once warm
+  std::vector<std::vector<int> > m_step_subsets;
+  std::vector<std::vector<int> > m_next_subsets;
+  std::vector<uint64_t> m_step_counts;
+  std::vector<uint64_t> m_next_counts;
+  int m_step_size;
+  std::vector<int> m_merge;      // Open addressing table of indices of m_next_subsets, -1 if the slot is empty
+  std::vector<int> m_merge_used; // Slots of m_merge filled in the current step
+
+  /**
+   * @brief Returns the cached state of a subset of Nfa states, adding it if it isn't cached.
+   */
+  int state(const std::vector<int> &subset){
+    std::map<std::vector<int>, int>::iterator it = m_ids.find(subset);
+    if (it != m_ids.end())
+      return it->second;
+    int id = m_subsets.size();
+    m_ids[subset] = id;
+    m_subsets.push_back(subset);
+    m_next.resize(m_next.size() + m_class_count, -1);
+    m_slot.push_back(-1);
+    for (size_t i=0; i < subset.size(); i++)
+      if (m_nfa.states()[subset[i]].match >= 0)
+        m_match_ids.push_back(m_nfa.states()[subset[i]].match);
+    m_match_first.push_back(m_match_ids.size());
+    return id;
+  }
+
+  void closure(){
+    if (m_stamp == INT_MAX){
+      m_visited.assign(m_visited.size(), -1);
+      m_stamp = 0;
+    }
+    m_nfa.closure(m_stack, m_visited, m_stamp++, m_set);
+  }
+
+  /**
+   * @brief Returns the state reached from s reading a byte of class c, building it if needed.
+   */
+  int next(int s, int c){
+    int t = m_next[m_class_count*s + c];
+    return t >= 0 ? t : build(s, c);
+  }
+
+  int build(int s, int c){
+    int t;
+    unsigned char byte = m_class_bytes[c];
+    m_stack.clear();
+    for (size_t i=0; i < m_subsets[s].size(); i++){
+      const Nfa::State &nfa_state = m_nfa.states()[m_subsets[s][i]];
+      if (nfa_state.set >= 0 && m_nfa.sets()[nfa_state.set][byte])
+        m_stack.push_back(nfa_state.out1);
+    }
+    closure();
+    t = state(m_set);
+    m_next[m_class_count*s + c] = t;
+    return t;
+  }
+
+  /**
+   * @brief Empties the cache, keeping the dead state, the start state and the active states.
+   */
+  void flush(){
+    std::vector<std::vector<int> > active(m_active_size);
+    for (int j=0; j < m_active_size; j++)
+      active[j].swap(m_subsets[m_active[j].first]);
+    m_subsets.clear();
+    m_ids.clear();
+    m_next.clear();
+    m_slot.clear();
+    m_match_first.assign(1, 0);
+    m_match_ids.clear();
+    state(std::vector<int>());
+    m_start = state(m_start_subset);
+    for (int j=0; j < m_active_size; j++)
+      m_active[j].first = state(active[j]);
+    m_fill_bytes = 0;
+    m_flushes++;
+  }
+
+  void step(int c){
+    // Each state is active once, and a step can't build more states than the active ones and the start
+    size_t room = m_subsets.size() + m_active_size + 1;
+    if (m_next_active.size() < room){
+      m_active.resize(room);
+      m_next_active.resize(room);
+    }
+    int next_size = 0;
+    m_steps += m_active_size + 1;
+    int t = next(m_start, c);
+    if (t != 0){
+      m_slot[t] = 0;
+      m_next_active[next_size++] = ActiveState(t, 1);
+    }
+    for (int j=0; j < m_active_size; j++){
+      t = next(m_active[j].first, c);
+      if (t == 0)
+        continue;
+      if (m_slot[t] < 0){
+        m_slot[t] = next_size;
+        m_next_active[next_size++] = ActiveState(t, m_active[j].second);
+      } else
+        m_next_active[m_slot[t]].second += m_active[j].second;
+    }
+    // Building states may move the tables, so they are only taken once the transitions are known
+    const int* match_first = &m_match_first[0];
+    const int* match_ids = m_match_ids.empty() ? 0 : &m_match_ids[0];
+    int* slot = &m_slot[0];
+    uint64_t* counts = m_counts.empty() ? 0 : &m_counts[0];
+    for (int j=0; j < next_size; j++){
+      t = m_next_active[j].first;
+      slot[t] = -1;
+      for (int m=match_first[t]; m < match_first[t+1]; m++)
+        counts[match_ids[m]] += m_next_active[j].second;
+    }
+    m_active.swap(m_next_active);
+    m_active_size = next_size;
+  }
+
+  /**
+   * @brief Leaves the cache, taking the subsets of the active states, and empties it.
+   */
+  void startStepping(){
+    reserveStep(m_active_size);
+    for (int j=0; j < m_active_size; j++){
+      m_step_subsets[j] = m_subsets[m_active[j].first];
+      m_step_counts[j] = m_active[j].second;
+    }
+    m_step_size = m_active_size;
+    m_active_size = 0;
+    flush();
+    m_stepping = true;
+  }
+
+  void reserveStep(size_t size){
+    // A step reaches at most a subset for the start state and for each active subset
+    size_t room = size + 1;
+    if (m_step_subsets.size() < room){
+      m_step_subsets.resize(room);
+      m_next_subsets.resize(room);
+      m_step_counts.resize(room);
+      m_next_counts.resize(room);
+    }
+    if (m_merge.size() < 2*room){
+      size_t slots = 16;
+      while (slots < 2*room)
+        slots *= 2;
+      m_merge.assign(slots, -1);
+    }
+  }
+
+  /**
+   * @brief Steps the Nfa from every active subset, without the cache.
+   */
+  void stepNfa(int c){
+    unsigned char byte = m_class_bytes[c];
+    reserveStep(m_step_size);
+    size_t mask = m_merge.size() - 1;
+    int next_size = 0;
+    m_steps += m_step_size + 1;
+    for (int j=-1; j < m_step_size; j++){
+      const std::vector<int> &subset = j < 0 ? m_start_subset : m_step_subsets[j];
+      m_stack.clear();
+      for (size_t i=0; i < subset.size(); i++){
+        const Nfa::State &nfa_state = m_nfa.states()[subset[i]];
+        if (nfa_state.set >= 0 && m_nfa.sets()[nfa_state.set][byte])
+          m_stack.push_back(nfa_state.out1);
+      }
+      if (m_stack.empty())
+        continue;
+      closure();
+      if (m_set.empty())
+        continue;
+      uint64_t hash = 0xcbf29ce484222325ULL;
+      for (size_t i=0; i < m_set.size(); i++)
+        hash = (hash ^ m_set[i]) * 0x100000001b3ULL;
+      size_t h = hash & mask;
+      while (m_merge[h] >= 0 && m_next_subsets[m_merge[h]] != m_set)
+        h = (h + 1) & mask;
+      uint64_t starts = j < 0 ? 1 : m_step_counts[j];
+      if (m_merge[h] >= 0)
+        m_next_counts[m_merge[h]] += starts;
+      else {
+        m_merge[h] = next_size;
+        m_merge_used.push_back(h);
+        m_next_subsets[next_size] = m_set;
+        m_next_counts[next_size++] = starts;
+      }
+    }
+    for (size_t i=0; i < m_merge_used.size(); i++)
+      m_merge[m_merge_used[i]] = -1;
+    m_merge_used.clear();
+    uint64_t* counts = m_counts.empty() ? 0 : &m_counts[0];
+    for (int j=0; j < next_size; j++)
+      for (size_t i=0; i < m_next_subsets[j].size(); i++){
+        int match = m_nfa.states()[m_next_subsets[j][i]].match;
+        if (match >= 0)
+          counts[match] += m_next_counts[j];
+      }
+    m_step_subsets.swap(m_next_subsets);
+    m_step_counts.swap(m_next_counts);
+    m_step_size = next_size;
+  }
+
+public:
+
+  /**
+   * @brief Bytes of input per cached state below which refilling the cache is considered thrashing.
+   */
+  static const int thrash_bytes = 10;
+
+  /**
+   * @param nfa Automaton whose expressions are counted.
+   * @param max_states Maximum number of states of the cache.
+   */
+  LazyCounter(const Nfa &nfa, int max_states) : m_nfa(nfa){
+    m_max_states = max_states;
+    // Bytes which belong to the same sets of the Nfa share a class
+    int classes[256] = {0};
+    m_class_count = 1;
+    for (size_t i=0; i < nfa.sets().size(); i++){
+      std::map<std::pair<int, bool>, int> split;
+      for (int b=0; b < 256; b++){
+        std::pair<int, bool> key(classes[b], nfa.sets()[i][b]);
+        std::map<std::pair<int, bool>, int>::iterator it = split.find(key);
+        if (it == split.end())
+          it = split.insert(std::make_pair(key, (int)split.size())).first;
+        classes[b] = it->second;
+      }
+      m_class_count = split.size();
+    }
+    for (int b=255; b >= 0; b--){
+      m_classes[b] = classes[b];
+      m_class_bytes[classes[b]] = b;
+    }
+    m_visited.assign(nfa.states().size(), -1);
+    m_stamp = 0;
+    m_stack = nfa.starts();
+    closure();
+    m_start_subset = m_set;
+    m_active_size = 0;
+    m_flushes = 0;
+    flush();
+    m_flushes = 0;
+    reset();
+  }
+
+  /**
+   * @brief Prepares the counter to count the matches of a new input. The cached states are kept.
+   */
+  void reset(){
+    m_active_size = 0;
+    m_step_size = 0;
+    m_counts.assign(m_nfa.regexs(), 0);
+    m_steps = 0;
+    m_stepping = false;
+  }
+
+  /**
+   * @brief Counts the matches which end in data. Matches which start in a previous call are also counted.
+   */
+  void feed(const char* data, size_t length){
+    size_t i = 0;
+    for (; i < length && !m_stepping; i++){
+      // A step adds at most a state for the start state and for each active state
+      if (m_subsets.size() + m_active_size + 1 > (size_t)m_max_states){
+        if (m_fill_bytes < (uint64_t)thrash_bytes * m_max_states){
+          startStepping();
+          break;
+        }
+        flush();
+      }
+      m_fill_bytes++;
+      step(m_classes[(unsigned char)data[i]]);
+    }
+    for (; i < length; i++)
+      stepNfa(m_classes[(unsigned char)data[i]]);
+  }
+
+  /**
+   * @brief Returns the number of matches of each expression counted since the last reset.
+   */
+  const std::vector<uint64_t>& counts() const{
+    return m_counts;
+  }
+
+  /**
+   * @brief Returns the transitions followed since the last reset, like MatchCounter::steps.
+   */
+  uint64_t steps() const{
+    return m_steps;
+  }
+
+  /**
+   * @brief Returns the number of states in the cache.
+   */
+  int states() const{
+    return m_subsets.size();
+  }
+
+  /**
+   * @brief Returns how many times the cache has been emptied.
+   */
+  uint64_t flushes() const{
+    return m_flushes;
+  }
+
+  /**
+   * @brief Returns whether the transitions of the current input are computed from the Nfa.
+   */
+  bool stepping() const{
+    return m_stepping;
+  }
+};
+
+#endif
@@ -0,0 +1,294 @@
+/**
+ * @file classifier.hpp
+ * @brief Classifier which calculates the reliability of every format of a trained model for memory buffers
+ */
+
+#ifndef _CLASSIFIER_H_
+#define _CLASSIFIER_H_
+
+#include <string>
+#include <vector>
+#include "automaton.hpp"
+#include "model.hpp"
+
+
+
+/**
+ * @brief Classifies memory buffers with the expressions of a model. Without the prestage it obtains the same
+ * reliabilities as the fguess program generated from the same training, ClassifierSession and fguessd, which
+ * never use it. When the model has a prestage and it's enabled (the default), the byte histogram of the prefix
+ * of each buffer discards the formats it can't be, and classify gives them reliability 0 instead of the one of
+ * their matches. The buffer is scanned once for the remaining formats, and not at all if every format is
+ * discarded. Once loaded, the classifier isn't modified, so it can be used by several threads at the same time.
+ */
+class Classifier{
+private:
+  Model m_model;
+  Dfa m_dfa;
+  std::vector<double> m_goodness;
+  std::vector<int> m_first_regex;     // Index of the first expression of each format
+  std::vector<int> m_prestage_format; // Format of the prestage of each format of the model, or -1
+  bool m_use_prestage;
+
+  /**
+   * @brief Returns the reliability of a format from the matches of its expressions.
+   * @param counts Matches of the expressions of the format, starting at the first one.
+   */
+  double reliability(int format, const uint64_t* counts) const{
+    double reliability = 0;
+    for (size_t j=0; j < m_model.regexs(format).size(); j++)
+      reliability += m_goodness[m_first_regex[format] + j] * counts[j];
+    return reliability / (reliability+100);
+  }
+
+public:
+
+  /**
+   * @brief Default maximum number of states of the automaton of a model.
+   */
+  static const int default_max_states = 1 << 16;
+
+  Classifier(){
+    m_use_prestage = true;
+  }
+
+  /**
+   * @brief Loads a model and builds the automaton of all its expressions.
+   * @param filename Path of the fguess.model file.
+   * @param max_states Maximum number of states of the automaton.
+   * @return false if the model can't be read or its automaton exceeds max_states.
+   */
+  bool load(const std::string &filename, int max_states = default_max_states){
+    Model model;
+    if (!model.load(filename))
+      return false;
+    return build(model, max_states);
+  }
+
+  /**
+   * @brief Builds the minimal automaton of all the expressions of a model.
+   * @return false if the automaton exceeds max_states.
+   */
+  bool build(const Model &model, int max_states = default_max_states){
+    Nfa nfa;
+    m_model = model;
+    m_goodness.clear();
+    m_first_regex.clear();
+    for (int i=0; i < model.formats(); i++){
+      m_first_regex.push_back(m_goodness.size());
+      for (size_t j=0; j < model.regexs(i).size(); j++){
+        nfa.addRegex(model.regexs(i)[j].first);
+        m_goodness.push_back(model.regexs(i)[j].second);
+      }
+    }
+    if (!m_dfa.build(nfa, max_states))
+      return false;
+    m_dfa.minimize();
+
+    m_prestage_format.assign(model.formats(), -1);
+    for (int i=0; i < model.formats(); i++)
+      for (int j=0; j < model.prestage().formats(); j++)
+        if (model.prestage().formatName(j) == model.formatName(i))
+          m_prestage_format[i] = j;
+    return true;
+  }
+
+  /**
+   * @brief Enables or disables the prestage of classify, which is used by default when the model has one.
+   * Disabled, classify gives the reliabilities of ClassifierSession and fguess. It must be called before
+   * sharing the classifier.
+   */
+  void usePrestage(bool enabled){
+    m_use_prestage = enabled;
+  }
+
+  /**
+   * @brief Returns whether the buffers are filtered by the prestage.
+   */
+  bool prestage() const{
+    return m_use_prestage && !m_model.prestage().empty();
+  }
+
+  /**
+   * @brief Returns the number of formats of the model.
+   */
+  int formats() const{
+    return m_model.formats();
+  }
+
+  const std::string& formatName(int i) const{
+    return m_model.formatName(i);
+  }
+
+  const Model& model() const{
+    return m_model;
+  }
+
+  const Dfa& dfa() const{
+    return m_dfa;
+  }
+
+  /**
+   * @brief Calculates the reliability of every format from the matches of each expression, with the
+   * formula of the fguess program.
+   * @param counts Matches of each expression, in the order of the model.
+   * @param reliabilities Array of formats() elements where the reliabilities are written.
+   */
+  void reliabilities(const std::vector<uint64_t> &counts, double* reliabilities) const{
+    for (int i=0; i < formats(); i++)
+      reliabilities[i] = counts.empty() ? reliability(i, NULL) : reliability(i, &counts[m_first_regex[i]]);
+  }
+
+  /**
+   * @brief Calculates the reliability with which a buffer is of each format. With the prestage, the formats
+   * which it discards get 0. Buffers are read in place and, after the first call of each thread, nothing is
+   * allocated.
+   * @param data Buffer to classify.
+   * @param length Length of data.
+   * @param reliabilities Array of formats() elements where the reliabilities are written.
+   */
+  void classify(const char* data, size_t length, double* reliabilities) const{
+    static thread_local MatchCounter counter;
+    static thread_local std::vector<char> keep;
+    bool scan = true;
+    if (prestage()){
+      m_model.prestage().candidates(data, length, keep);
+      scan = false;
+      for (int i=0; i < formats() && !scan; i++)
+        scan = m_prestage_format[i] < 0 || keep[m_prestage_format[i]];
+    }
+    if (!scan){
+      for (int i=0; i < formats(); i++)
+        reliabilities[i] = 0;
+      return;
+    }
+    // The remaining formats are scanned at once with the automaton of the whole model, whose matches of the
+    // discarded formats are ignored: an automaton per format would scan the buffer once per format
+    counter.reset(m_dfa, m_goodness.size());
+    counter.feed(data, length);
+    this->reliabilities(counter.counts(), reliabilities);
+    if (prestage())
+      for (int i=0; i < formats(); i++)
+        if (m_prestage_format[i] >= 0 && !keep[m_prestage_format[i]])
+          reliabilities[i] = 0;
+  }
+
+  void classify(const std::string &data, double* reliabilities) const{
+    classify(data.data(), data.size(), reliabilities);
+  }
+
+  /**
+   * @brief Classifies several buffers like classify, scanning up to streams of them at once, a byte of each
+   * in turn. It's an experiment with MatchCounter::feedStreams which has measured about twice slower than
+   * calling classify on each buffer (make classifier-bench, the streams backends).
+   * @param data Buffers to classify.
+   * @param lengths Length of each buffer.
+   * @param buffers Number of buffers.
+   * @param reliabilities Array of buffers * formats() elements where the reliabilities of each buffer are
+   * written one after the other.
+   * @param streams Buffers scanned at once, at most MatchCounter::max_streams.
+   */
+  void classifyBatch(const char* const* data, const size_t* lengths, int buffers, double* reliabilities, int streams) const{
+    static thread_local std::vector<MatchCounter> counters(MatchCounter::max_streams);
+    static thread_local std::vector<std::vector<char> > keeps(MatchCounter::max_streams);
+    MatchCounter* stream_counters[MatchCounter::max_streams];
+    const char* stream_data[MatchCounter::max_streams];
+    size_t stream_lengths[MatchCounter::max_streams];
+    int stream_buffers[MatchCounter::max_streams];
+    streams = std::max(1, std::min(streams, (int)MatchCounter::max_streams));
+    int scanned = 0;
+    for (int b=0; b <= buffers; b++){
+      // The buffers which the prestage discards entirely aren't scanned
+      bool scan = b < buffers;
+      std::vector<char> &keep = keeps[scanned];
+      if (scan && prestage()){
+        m_model.prestage().candidates(data[b], lengths[b], keep);
+        scan = false;
+        for (int i=0; i < formats() && !scan; i++)
+          scan = m_prestage_format[i] < 0 || keep[m_prestage_format[i]];
+        if (!scan)
+          for (int i=0; i < formats(); i++)
+            reliabilities[b*formats() + i] = 0;
+      }
+      if (scan){
+        counters[scanned].reset(m_dfa, m_goodness.size());
+        stream_counters[scanned] = &counters[scanned];
+        stream_data[scanned] = data[b];
+        stream_lengths[scanned] = lengths[b];
+        stream_buffers[scanned++] = b;
+      }
+      if (scanned == streams || (b == buffers && scanned > 0)){
+        MatchCounter::feedStreams(stream_counters, stream_data, stream_lengths, scanned);
+        for (int l=0; l < scanned; l++){
+          double* buffer_reliabilities = reliabilities + stream_buffers[l]*formats();
+          this->reliabilities(counters[l].counts(), buffer_reliabilities);
+          if (prestage())
+            for (int i=0; i < formats(); i++)
+              if (m_prestage_format[i] >= 0 && !keeps[l][m_prestage_format[i]])
+                buffer_reliabilities[i] = 0;
+        }
+        scanned = 0;
+      }
+    }
+  }
+};
+
+
+/**
+ * @brief Classifies a stream which arrives in chunks. The partial matches are kept between chunks, so the
+ * reliabilities are the same as classifying the concatenation of all the chunks without the prestage, which
+ * sessions never use. The memory of a session depends only on the model, not on the data fed.
+ */
+class ClassifierSession{
+private:
+  const Classifier* m_classifier;
+  MatchCounter m_counter;
+  uint64_t m_bytes;
+
+public:
+
+  /**
+   * @param classifier Classifier of the stream. It must outlive the session.
+   */
+  ClassifierSession(const Classifier &classifier){
+    m_classifier = &classifier;
+    reset();
+  }
+
+  /**
+   * @brief Forgets the data fed, starting a new stream.
+   */
+  void reset(){
+    m_counter.reset(m_classifier->dfa(), m_classifier->model().regexsNum());
+    m_bytes = 0;
+  }
+
+  /**
+   * @brief Classifies the next chunk of the stream.
+   */
+  void feed(const char* data, size_t length){
+    m_counter.feed(data, length);
+    m_bytes += length;
+  }
+
+  void feed(const std::string &data){
+    feed(data.data(), data.size());
+  }
+
+  /**
+   * @brief Writes the reliability of every format for the data fed until now.
+   * @param reliabilities Array of formats() elements of the classifier.
+   */
+  void reliabilities(double* reliabilities) const{
+    m_classifier->reliabilities(m_counter.counts(), reliabilities);
+  }
+
+  /**
+   * @brief Returns the number of bytes fed since the last reset.
+   */
+  uint64_t bytes() const{
+    return m_bytes;
+  }
+};
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ * @file corpus.hpp
+ * @brief Generator of synthetic training corpora which imitate the files of each format
+ */
+
+#ifndef _CORPUS_H_
+#define _CORPUS_H_
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <random>
+#include <unordered_map>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+
+
+
+/**
+ * @brief Generates text with the structure of some sample files. The output copies runs of the samples
+ * and, at the end of each run, jumps to a random position of the samples preceded by the same context
+ * bytes, so every window of context+1 bytes of the output appears in the samples. Most of the output is
+ * copied in blocks, which keeps the generation fast enough for corpora of tens of GB.
+ */
+class TextModel{
+private:
+  static const int context = 4;
+  std::string m_text;
+  std::vector<size_t> m_file_starts;
+  std::unordered_map<uint32_t, std::vector<uint32_t> > m_successors;
+  int m_rotation;
+
+  static uint32_t contextKey(const char* end){
+    uint32_t key = 0;
+    for (int i=-context; i < 0; i++)
+      key = (key << 8) | (unsigned char)end[i];
+    return key;
+  }
+
+  /**
+   * @brief Shifts the letters like a Caesar cipher, which gives a different format with the same structure.
+   */
+  void rotate(char* data, size_t length) const{
+    for (size_t i=0; i < length; i++){
+      if (data[i] >= 'a' && data[i] <= 'z')
+        data[i] = 'a' + (data[i] - 'a' + m_rotation) % 26;
+      else if (data[i] >= 'A' && data[i] <= 'Z')
+        data[i] = 'A' + (data[i] - 'A' + m_rotation) % 26;
+    }
+  }
+
+public:
+
+  TextModel(){
+    m_rotation = 0;
+  }
+
+  /**
+   * @brief Adds a sample file.
+   */
+  void addSample(const std::string &data){
+    if (data.size() <= context) return;
+    m_file_starts.push_back(m_text.size());
+    m_text += data;
+  }
+
+  /**
+   * @brief Indexes the samples. It must be called after adding them and before generating.
+   */
+  void build(){
+    m_successors.clear();
+    for (size_t i=context; i < m_text.size(); i++)
+      m_successors[contextKey(m_text.data() + i)].push_back(i);
+  }
+
+  /**
+   * @brief Sets the number of positions the letters of the output are shifted (0 keeps them).
+   */
+  void setRotation(int rotation){
+    m_rotation = rotation % 26;
+  }
+
+  bool empty() const{
+    return m_file_starts.empty();
+  }
+
+  /**
+   * @brief Writes length bytes of synthetic text.
+   * @param out File where the text is written.
+   * @param length Number of bytes.
+   * @param rng Random generator, so equal seeds give equal corpora.
+   * @param run_length Mean length of the runs copied from the samples.
+   * @return false if the text can't be written.
+   */
+  bool generate(FILE* out, uint64_t length, std::mt19937_64 &rng, int run_length = 64) const{
+    std::vector<char> buffer;
+    std::geometric_distribution<int> run(1.0 / run_length);
+    size_t pos = m_file_starts[rng() % m_file_starts.size()];
+
+    while (length > 0){
+      size_t n = std::min<uint64_t>(length, 1 + run(rng));
+      if (pos + n > m_text.size())
+        n = m_text.size() - pos;
+      const char* run_data = m_text.data() + pos;
+      if (m_rotation != 0){
+        buffer.assign(run_data, run_data + n);
+        rotate(&buffer[0], n);
+        run_data = &buffer[0];
+      }
+      if (fwrite(run_data, 1, n, out) != n)
+        return false;
+      length -= n;
+      pos += n;
+      if (pos == m_text.size() || pos < context){
+        pos = m_file_starts[rng() % m_file_starts.size()];
+      } else {
+        const std::vector<uint32_t> &successors = m_successors.find(contextKey(m_text.data() + pos))->second;
+        pos = successors[rng() % successors.size()];
+      }
+    }
+    return true;
+  }
+};
+
+
+/**
+ * @brief Distribution of the sizes of the generated files.
+ */
+class SizeDistribution{
+private:
+  std::string m_name;
+  double m_mean;
+
+public:
+
+  /**
+   * @param name "fixed" (every file of the mean size), "uniform" (between half and one and a half times
+   * the mean) or "lognormal" (with the given mean and a long tail of big files).
+   * @param mean Mean size in bytes.
+   */
+  SizeDistribution(const std::string &name, double mean){
+    m_name = name;
+    m_mean = mean;
+  }
+
+  bool valid() const{
+    return m_name == "fixed" || m_name == "uniform" || m_name == "lognormal";
+  }
+
+  uint64_t sample(std::mt19937_64 &rng) const{
+    double size = m_mean;
+    if (m_name == "uniform")
+      size = std::uniform_real_distribution<double>(0.5 * m_mean, 1.5 * m_mean)(rng);
+    else if (m_name == "lognormal")
+      // With sigma 1 the mean of the distribution is exp(mu + 1/2)
+      size = std::lognormal_distribution<double>(log(m_mean) - 0.5, 1.0)(rng);
+    return size < 1 ? 1 : (uint64_t)size;
+  }
+};
+
+#endif
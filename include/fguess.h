@@ -0,0 +1,90 @@
+/**
+ * @file fguess.h
+ * @brief C interface of the classifier library
+ */
+
+#ifndef _FGUESS_H_
+#define _FGUESS_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Trained model ready to classify. It isn't modified after loading, so it can be shared by threads.
+ */
+typedef struct fguess_model fguess_model;
+
+/**
+ * @brief Loads a fguess.model file written by the training.
+ * @return The model, or NULL if it can't be loaded.
+ */
+fguess_model* fguess_model_load(const char* path);
+
+/**
+ * @brief Frees a model loaded with fguess_model_load.
+ */
+void fguess_model_free(fguess_model* model);
+
+/**
+ * @brief Returns the number of formats of the model.
+ */
+int fguess_formats_num(const fguess_model* model);
+
+/**
+ * @brief Returns the name of the format i, valid while the model isn't freed.
+ */
+const char* fguess_format_name(const fguess_model* model, int i);
+
+/**
+ * @brief Enables (the default) or disables the byte histogram prestage of fguess_classify, which gives
+ * reliability 0 to the formats whose bytes are unlikely in the buffer, and doesn't scan the buffer if every
+ * format is. Disabled, fguess_classify gives the reliabilities of the streams and the generated fguess, which
+ * never use it. It must be called before sharing the model.
+ */
+void fguess_model_prestage(fguess_model* model, int enabled);
+
+/**
+ * @brief Calculates the reliability with which a buffer is of each format. The buffer is read in place.
+ * @param model Model used to classify.
+ * @param data Buffer to classify.
+ * @param length Length of data.
+ * @param reliabilities Array where the reliability of each format is written.
+ * @param reliabilities_num Length of reliabilities.
+ * @return The number of formats, or -1 if reliabilities is too short.
+ */
+int fguess_classify(const fguess_model* model, const void* data, size_t length, double* reliabilities, int reliabilities_num);
+
+/**
+ * @brief Classification of a stream which arrives in chunks.
+ */
+typedef struct fguess_stream fguess_stream;
+
+/**
+ * @brief Starts the classification of a stream. The model must outlive the stream.
+ */
+fguess_stream* fguess_stream_new(const fguess_model* model);
+
+/**
+ * @brief Frees a stream created with fguess_stream_new.
+ */
+void fguess_stream_free(fguess_stream* stream);
+
+/**
+ * @brief Classifies the next chunk of the stream. Matches across chunks are counted.
+ */
+void fguess_stream_feed(fguess_stream* stream, const void* data, size_t length);
+
+/**
+ * @brief Writes the reliability of each format for the data fed until now.
+ * @return The number of formats, or -1 if reliabilities is too short.
+ */
+int fguess_stream_reliabilities(const fguess_stream* stream, double* reliabilities, int reliabilities_num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,6 +1,6 @@
  /**
  * @file file_templates.hpp
- * @brief Classes for generate the lex files count.lex and fguess.lex
+ * @brief Classes for generate the lex files count.lex and fguess.lex, the C classifier fguess.c and fguess.model
  */
 
 #ifndef _FILE_TEMPLATES_H_
@@ -8,6 +8,8 @@
 #include <fstream>
 #include <string>
 #include <stdlib.h>
+#include "automaton.hpp"
+#include "prestage.hpp"
 
 
 
@@ -111,9 +113,377 @@ public:
  * @brief Generates the fguess.lex program which calculates the reliability with which a file is of a certain format.
  */
 class OutputTemplate : public FileTemplate{
-private:
+protected:
   std::map<std::string, std::vector<std::pair<std::string, double> > > regex_data;
 
+  /**
+   * @brief Returns the C declarations shared by the generated classifiers: the goodness of every regex, the
+   * reliability formula and the input reading with the early exit options. The matches of the regex k of
+   * all the formats are counted in ScanState::matches[k].
+   */
+  std::string declarations() const{
+    std::string goodness = "{";
+    std::string regex_num = "{";
+    std::string format_names = "{";
+    int k = 0;
+    std::map<std::string, std::vector<std::pair<std::string, double> > >::const_iterator it;
+    for (it = regex_data.begin(); it != regex_data.end(); ++it){
+      for (std::vector<std::pair<std::string, double> >::const_iterator it2 = (*it).second.begin(); it2 != (*it).second.end(); ++it2, k++)
+        goodness += std::to_string(it2->second) + ",";
+      regex_num += std::to_string(it->second.size()) + ",";
+      format_names += "\"" + it->first + "\"" + ",";
+    }
+    goodness.pop_back();
+    goodness += "}";
+    regex_num.pop_back();
+    regex_num += "}";
+    format_names.pop_back();
+    format_names += "}";
+    std::string formats_num = std::to_string(regex_data.size());
+    std::string regexs_num = std::to_string(k);
+
+    std::string str;
+    str =
+  "#include <stdio.h>\n"
+  "#include <stdlib.h>\n"
+  "#include <string.h>\n"
+  "#include <pthread.h>\n"
+  "#include <dirent.h>\n"
+  "#include <unistd.h>\n"
+  "#include <sys/stat.h>\n"
+  "#define formats_num ";
+  str += formats_num;
+  str +=
+  " // Number of formats for which we obtain the reliability\n"
+  "#define regexs_num ";
+  str += regexs_num;
+  str +=
+  " // Number of regexs of all the formats\n"
+  "const int regex_num[] = ";
+  str += regex_num;
+  str +=
+  ";\n"
+  "const double goodness[] = ";
+  str += goodness;
+  str +=
+  ";\n"
+  "const char* format_names[] = ";
+  str += format_names;
+  str +=
+  ";\n"
+  "double exit_margin = 0; // Lead of the best format over the second one which stops the scan (0 disables it)\n"
+  "long byte_budget = 0; // Maximum number of bytes scanned (0 means no limit)\n"
+  "long sample_window = 0; // Size of the head, middle and tail windows read from seekable files (0 reads everything)\n"
+  "struct ScanState{\n"
+  "  FILE* in;\n"
+  "  int matches[regexs_num];\n"
+  "  long bytes_scanned;\n"
+  "  long window_offsets[3];\n"
+  "  int window_num, window_index;\n"
+  "  long window_left;\n"
+  "};\n"
+  "double reliability(struct ScanState* s, int i){\n"
+  "  double r = 0;\n"
+  "  int first = 0;\n"
+  "  for (int f=0; f < i; f++)\n"
+  "    first += regex_num[f];\n"
+  "  for (int j=first; j < first+regex_num[i]; j++)\n"
+  "    r += goodness[j] * s->matches[j];\n"
+  "  return r / (r+100);\n"
+  "}\n"
+  "int isSettled(struct ScanState* s){\n"
+  "  double first = 0, second = 0, r;\n"
+  "  if (exit_margin <= 0)\n"
+  "    return 0;\n"
+  "  for (int i=0; i < formats_num; i++){\n"
+  "    r = reliability(s, i);\n"
+  "    if (r > first){\n"
+  "      second = first;\n"
+  "      first = r;\n"
+  "    } else if (r > second) second = r;\n"
+  "  }\n"
+  "  return first - second > exit_margin;\n"
+  "}\n"
+  "void planWindows(struct ScanState* s){\n"
+  "  long size;\n"
+  "  if (sample_window <= 0 || fseek(s->in, 0, SEEK_END) != 0)\n"
+  "    return;\n"
+  "  size = ftell(s->in);\n"
+  "  if (fseek(s->in, 0, SEEK_SET) != 0 || size <= 3*sample_window)\n"
+  "    return;\n"
+  "  s->window_offsets[0] = 0;\n"
+  "  s->window_offsets[1] = size/2 - sample_window/2;\n"
+  "  s->window_offsets[2] = size - sample_window;\n"
+  "  s->window_num = 3;\n"
+  "  s->window_left = sample_window;\n"
+  "}\n"
+  "int readInput(struct ScanState* s, char* buf, int max_size){\n"
+  "  int n;\n"
+  "  if ((byte_budget > 0 && s->bytes_scanned >= byte_budget) || isSettled(s))\n"
+  "    return 0;\n"
+  "  if (byte_budget > 0 && byte_budget - s->bytes_scanned < max_size)\n"
+  "    max_size = byte_budget - s->bytes_scanned;\n"
+  "  if (s->window_num > 0){\n"
+  "    if (s->window_left == 0){\n"
+  "      if (++s->window_index == s->window_num || fseek(s->in, s->window_offsets[s->window_index], SEEK_SET) != 0)\n"
+  "        return 0;\n"
+  "      s->window_left = sample_window;\n"
+  "    }\n"
+  "    if (s->window_left < max_size)\n"
+  "      max_size = s->window_left;\n"
+  "  }\n"
+  "  n = fread(buf, 1, max_size, s->in);\n"
+  "  s->window_left -= n;\n"
+  "  s->bytes_scanned += n;\n"
+  "  return n;\n"
+  "}\n";
+
+    return str;
+  }
+
+  /**
+   * @brief Returns the C procedures shared by the generated classifiers: the batch mode and the main function.
+   * They use the Scanner type and the newScanner, freeScanner and scanFile functions of each classifier.
+   */
+  static std::string procedures(){
+    std::string str;
+    str =
+  "// Batch mode: the workers share a queue with the files and directories pending to classify\n"
+  "struct WorkItem{\n"
+  "  char* path;\n"
+  "  int top_level;\n"
+  "  struct WorkItem* next;\n"
+  "};\n"
+  "struct WorkItem* queue_head = NULL;\n"
+  "struct WorkItem* queue_tail = NULL;\n"
+  "long queued = 0, pending = 0, queue_limit = 65536;\n"
+  "int producing = 1;\n"
+  "pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;\n"
+  "pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;\n"
+  "pthread_cond_t room_cond = PTHREAD_COND_INITIALIZER;\n"
+  "\n"
+  "void pushWork(const char* path, int top_level){\n"
+  "  struct WorkItem* item = (struct WorkItem*)malloc(sizeof(struct WorkItem));\n"
+  "  item->path = strdup(path);\n"
+  "  item->top_level = top_level;\n"
+  "  item->next = NULL;\n"
+  "  pthread_mutex_lock(&queue_mutex);\n"
+  "  // Only the producer of the top level paths waits, the workers never block adding directory entries\n"
+  "  while (top_level && queued >= queue_limit)\n"
+  "    pthread_cond_wait(&room_cond, &queue_mutex);\n"
+  "  if (queue_tail != NULL) queue_tail->next = item;\n"
+  "  else queue_head = item;\n"
+  "  queue_tail = item;\n"
+  "  queued++;\n"
+  "  pending++;\n"
+  "  pthread_cond_signal(&work_cond);\n"
+  "  pthread_mutex_unlock(&queue_mutex);\n"
+  "}\n"
+  "\n"
+  "struct WorkItem* popWork(){\n"
+  "  struct WorkItem* item = NULL;\n"
+  "  pthread_mutex_lock(&queue_mutex);\n"
+  "  while (queue_head == NULL && (pending > 0 || producing))\n"
+  "    pthread_cond_wait(&work_cond, &queue_mutex);\n"
+  "  if (queue_head != NULL){\n"
+  "    item = queue_head;\n"
+  "    queue_head = item->next;\n"
+  "    if (queue_head == NULL) queue_tail = NULL;\n"
+  "    queued--;\n"
+  "    pthread_cond_signal(&room_cond);\n"
+  "  }\n"
+  "  pthread_mutex_unlock(&queue_mutex);\n"
+  "  return item;\n"
+  "}\n"
+  "\n"
+  "void finishWork(){\n"
+  "  pthread_mutex_lock(&queue_mutex);\n"
+  "  if (--pending == 0)\n"
+  "    pthread_cond_broadcast(&work_cond);\n"
+  "  pthread_mutex_unlock(&queue_mutex);\n"
+  "}\n"
+  "\n"
+  "void printJsonString(const char* str){\n"
+  "  putchar('\"');\n"
+  "  for (const unsigned char* c = (const unsigned char*)str; *c != '\\0'; c++)\n"
+  "    if (*c == '\"' || *c == '\\\\') printf(\"\\\\%c\", *c);\n"
+  "    else if (*c < 0x20) printf(\"\\\\u%04x\", *c);\n"
+  "    else putchar(*c);\n"
+  "  putchar('\"');\n"
+  "}\n"
+  "\n"
+  "void printResult(const char* path, struct ScanState* s){\n"
+  "  double rel[formats_num];\n"
+  "  int best = 0;\n"
+  "  for (int i=0; i < formats_num; i++){\n"
+  "    rel[i] = reliability(s, i);\n"
+  "    if (rel[i] > rel[best]) best = i;\n"
+  "  }\n"
+  "  flockfile(stdout);\n"
+  "  printf(\"{\\\"path\\\":\");\n"
+  "  printJsonString(path);\n"
+  "  printf(\",\\\"bytes\\\":%ld,\\\"format\\\":\", s->bytes_scanned);\n"
+  "  printJsonString(format_names[best]);\n"
+  "  printf(\",\\\"reliability\\\":{\");\n"
+  "  for (int i=0; i < formats_num; i++){\n"
+  "    if (i > 0) putchar(',');\n"
+  "    printJsonString(format_names[i]);\n"
+  "    printf(\":%lf\", rel[i]);\n"
+  "  }\n"
+  "  printf(\"}}\\n\");\n"
+  "  funlockfile(stdout);\n"
+  "}\n"
+  "\n"
+  "void printError(const char* path, const char* error){\n"
+  "  flockfile(stdout);\n"
+  "  printf(\"{\\\"path\\\":\");\n"
+  "  printJsonString(path);\n"
+  "  printf(\",\\\"error\\\":\\\"%s\\\"}\\n\", error);\n"
+  "  funlockfile(stdout);\n"
+  "}\n"
+  "\n"
+  "void classifyPath(Scanner scanner, struct ScanState* s, const char* path, int top_level){\n"
+  "  struct stat st;\n"
+  "  if ((top_level ? stat(path, &st) : lstat(path, &st)) != 0){\n"
+  "    printError(path, \"can't be opened\");\n"
+  "    return;\n"
+  "  }\n"
+  "  if (S_ISDIR(st.st_mode)){\n"
+  "    DIR* dir = opendir(path);\n"
+  "    struct dirent* entry;\n"
+  "    size_t len = strlen(path);\n"
+  "    char* child;\n"
+  "    if (dir == NULL){\n"
+  "      printError(path, \"can't be opened\");\n"
+  "      return;\n"
+  "    }\n"
+  "    while ((entry = readdir(dir)) != NULL){\n"
+  "      if (strcmp(entry->d_name, \".\") == 0 || strcmp(entry->d_name, \"..\") == 0)\n"
+  "        continue;\n"
+  "      child = (char*)malloc(len + strlen(entry->d_name) + 2);\n"
+  "      sprintf(child, (len > 0 && path[len-1] == '/') ? \"%s%s\" : \"%s/%s\", path, entry->d_name);\n"
+  "      pushWork(child, 0);\n"
+  "      free(child);\n"
+  "    }\n"
+  "    closedir(dir);\n"
+  "  } else if (S_ISREG(st.st_mode)){\n"
+  "    FILE* in = fopen(path, \"rb\");\n"
+  "    if (in == NULL){\n"
+  "      printError(path, \"can't be opened\");\n"
+  "      return;\n"
+  "    }\n"
+  "    scanFile(scanner, s, in);\n"
+  "    fclose(in);\n"
+  "    printResult(path, s);\n"
+  "  }\n"
+  "}\n"
+  "\n"
+  "void* batchWorker(void* arg){\n"
+  "  struct ScanState* s = (struct ScanState*)malloc(sizeof(struct ScanState));\n"
+  "  struct WorkItem* item;\n"
+  "  Scanner scanner = newScanner(s);\n"
+  "  while ((item = popWork()) != NULL){\n"
+  "    classifyPath(scanner, s, item->path, item->top_level);\n"
+  "    free(item->path);\n"
+  "    free(item);\n"
+  "    finishWork();\n"
+  "  }\n"
+  "  freeScanner(scanner);\n"
+  "  free(s);\n"
+  "  return NULL;\n"
+  "}\n"
+  "\n"
+  "int main(int argc, char** argv){\n"
+  "  char** paths = (char**)malloc(sizeof(char*)*argc);\n"
+  "  char* list_path = NULL;\n"
+  "  int paths_num = 0, batch = 0, threads = 0;\n"
+  "  for (int i=1; i < argc;)\n"
+  "    if (strcmp(argv[i], \"-margin\") == 0 && i+1 < argc){\n"
+  "      exit_margin = strtod(argv[i+1], NULL);\n"
+  "      i+=2;\n"
+  "    } else if (strcmp(argv[i], \"-budget\") == 0 && i+1 < argc){\n"
+  "      byte_budget = atol(argv[i+1]);\n"
+  "      i+=2;\n"
+  "    } else if (strcmp(argv[i], \"-sample\") == 0 && i+1 < argc){\n"
+  "      sample_window = atol(argv[i+1]);\n"
+  "      i+=2;\n"
+  "    } else if (strcmp(argv[i], \"-threads\") == 0 && i+1 < argc){\n"
+  "      threads = atoi(argv[i+1]);\n"
+  "      i+=2;\n"
+  "    } else if (strcmp(argv[i], \"-list\") == 0 && i+1 < argc){\n"
+  "      list_path = argv[i+1];\n"
+  "      batch = 1;\n"
+  "      i+=2;\n"
+  "    } else if (strcmp(argv[i], \"-batch\") == 0){\n"
+  "      batch = 1;\n"
+  "      i++;\n"
+  "    } else {\n"
+  "      paths[paths_num++] = argv[i];\n"
+  "      i++;\n"
+  "    }\n"
+  "\n"
+  "  if (!batch){\n"
+  "    struct ScanState* s = (struct ScanState*)malloc(sizeof(struct ScanState));\n"
+  "    FILE* in = stdin;\n"
+  "    Scanner scanner;\n"
+  "    if (paths_num > 0){\n"
+  "      in = fopen(paths[0], \"rb\");\n"
+  "      if(in == NULL){\n"
+  "        printf(\"The file %s can't be opened\\n\", paths[0]);\n"
+  "        exit(-1);\n"
+  "      }\n"
+  "    }\n"
+  "    scanner = newScanner(s);\n"
+  "    scanFile(scanner, s, in);\n"
+  "    for (int i=0; i < formats_num; i++)\n"
+  "      printf(\"The file is %s whith a reliability of %lf\\n\", format_names[i], reliability(s, i));\n"
+  "    freeScanner(scanner);\n"
+  "    free(s);\n"
+  "    free(paths);\n"
+  "    return 0;\n"
+  "  }\n"
+  "\n"
+  "  if (threads <= 0)\n"
+  "    threads = sysconf(_SC_NPROCESSORS_ONLN);\n"
+  "  if (threads <= 0)\n"
+  "    threads = 1;\n"
+  "  pthread_t* workers = (pthread_t*)malloc(sizeof(pthread_t)*threads);\n"
+  "  for (int i=0; i < threads; i++)\n"
+  "    pthread_create(&workers[i], NULL, batchWorker, NULL);\n"
+  "\n"
+  "  for (int i=0; i < paths_num; i++)\n"
+  "    pushWork(paths[i], 1);\n"
+  "  if (list_path != NULL){\n"
+  "    FILE* list = strcmp(list_path, \"-\") == 0 ? stdin : fopen(list_path, \"r\");\n"
+  "    char* line = NULL;\n"
+  "    size_t line_size = 0;\n"
+  "    ssize_t len;\n"
+  "    if (list == NULL)\n"
+  "      printError(list_path, \"can't be opened\");\n"
+  "    else {\n"
+  "      while ((len = getline(&line, &line_size, list)) != -1){\n"
+  "        if (len > 0 && line[len-1] == '\\n') line[--len] = '\\0';\n"
+  "        if (len > 0) pushWork(line, 1);\n"
+  "      }\n"
+  "      free(line);\n"
+  "      if (list != stdin) fclose(list);\n"
+  "    }\n"
+  "  }\n"
+  "  pthread_mutex_lock(&queue_mutex);\n"
+  "  producing = 0;\n"
+  "  pthread_cond_broadcast(&work_cond);\n"
+  "  pthread_mutex_unlock(&queue_mutex);\n"
+  "\n"
+  "  for (int i=0; i < threads; i++)\n"
+  "    pthread_join(workers[i], NULL);\n"
+  "  free(workers);\n"
+  "  free(paths);\n"
+  "  return 0;\n"
+  "}\n";
+
+    return str;
+  }
+
 public:
 
   /**
@@ -126,68 +496,42 @@ public:
     regex_data[format_name].push_back(std::pair<std::string, double>(regex, goodness));
   }
 
+  /**
+   * @brief Returns the stored expressions and goodness grouped by format.
+   */
+  const std::map<std::string, std::vector<std::pair<std::string, double> > >& regexData() const{
+    return regex_data;
+  }
+
 
   /**
    * @brief Generates a lex program which calculates the reliability with which a file is of a certain format
-   * using the expressions and goodness stored.
+   * using the expressions and goodness stored. The program can stop before the end of huge inputs once the
+   * best format leads by -margin, after -budget bytes or reading only -sample sized head, middle and tail windows.
+   * With -batch (or -list) it walks the given files and directories with -threads workers sharing the scanner
+   * tables and prints one JSON line per file.
    */
   std::string toString(){
     std::string rules = "";
-    std::string init_regex_data = "";
-    int i = 0, j = 0;
+    int k = 0;
     std::map<std::string, std::vector<std::pair<std::string, double> > >::iterator it;
-    for (it = regex_data.begin(); it != regex_data.end(); ++it, i++){
-      j = 0;
-      for (std::vector<std::pair<std::string, double> >::iterator it2 = (*it).second.begin(); it2 != (*it).second.end(); ++it2, j++){
+    for (it = regex_data.begin(); it != regex_data.end(); ++it)
+      for (std::vector<std::pair<std::string, double> >::iterator it2 = (*it).second.begin(); it2 != (*it).second.end(); ++it2, k++){
         rules += it2->first;
-        rules += " {formats_regex[";
-        rules += std::to_string(i);
-        rules += "][";
-        rules += std::to_string(j);
-        rules += "].matches++; REJECT;}\n";
-
-        init_regex_data += "  initRegexData(&formats_regex[";
-        init_regex_data += std::to_string(i);
-        init_regex_data += "][";
-        init_regex_data += std::to_string(j);
-        init_regex_data += "], ";
-        init_regex_data += std::to_string(it2->second);
-        init_regex_data += ");\n";
+        rules += " {yyextra->matches[";
+        rules += std::to_string(k);
+        rules += "]++; REJECT;}\n";
       }
-    }
-
-    std::string regex_num = "{";
-    std::string format_names = "{";
-    for (it = regex_data.begin(); it != regex_data.end(); ++it){
-      regex_num += std::to_string(it->second.size()) + ",";
-      format_names += "\"" + it->first + "\"" + ",";
-    }
-    regex_num.pop_back();
-    regex_num += "}";
-    format_names.pop_back();
-    format_names += "}";
 
-    std::string str = "";
-    str +=
+    std::string str;
+    str =
   "  /*----Declarations section----*/\n"
-  "%{"
-  "#include <stdio.h>\n"
-
-  "struct RegexData{\n"
-  "  double goodness;\n"
-  "  int matches;\n"
-  "};\n"
-
-  "void initRegexData(struct RegexData* rd, double goodness){\n"
-  "  rd->goodness = goodness;\n"
-  "  rd->matches = 0;\n"
-  "}\n"
-
-  "#define formats_num ";
-  str += std::to_string(regex_data.size());
+  "%option reentrant noyywrap\n"
+  "%option extra-type=\"struct ScanState*\"\n"
+  "%{\n";
+  str += declarations();
   str +=
-  " // Number of formats for which we obtain the reliability\n"
-  "struct RegexData** formats_regex;\n"
+  "#define YY_INPUT(buf,result,max_size) result = readInput(yyextra, buf, max_size);\n"
   "%}\n"
   "\n"
   "%%\n"
@@ -198,47 +542,245 @@ public:
   "\n"
   "%%\n"
   "  /*----Procedures section----*/\n"
-  "int main(int argc, char** argv){\n"
-  "  if (argc == 2){\n"
-  "    yyin = fopen(argv[1], \"rt\");\n"
-  "    if(yyin == NULL){\n"
-  "      printf(\"The file %s can't be opened\\n\", argv[1]);\n"
-  "      exit(-1);\n"
-  "    }\n"
-  "  }\n"
-  "  else yyin = stdin;\n"
-  "  char* format_names[] = ";
-  str += format_names;
-  str += ";\n"
-  "  formats_regex = (struct RegexData**)malloc(sizeof(struct RegexData*)*formats_num);\n"
-  "  int regex_num[] = ";
-  str += regex_num;
-  str += ";\n"
-  "  for (int i=0; i < formats_num; i++)\n"
-  "    formats_regex[i] = (struct RegexData*)malloc(sizeof(struct RegexData)*regex_num[i]);\n";
-  str += init_regex_data;
-  str +=
+  "typedef yyscan_t Scanner;\n"
+  "Scanner newScanner(struct ScanState* s){\n"
+  "  yyscan_t scanner;\n"
+  "  yylex_init_extra(s, &scanner);\n"
+  "  return scanner;\n"
+  "}\n"
+  "\n"
+  "void freeScanner(Scanner scanner){\n"
+  "  yylex_destroy(scanner);\n"
+  "}\n"
   "\n"
+  "void scanFile(Scanner scanner, struct ScanState* s, FILE* in){\n"
+  "  memset(s, 0, sizeof(struct ScanState));\n"
+  "  s->in = in;\n"
+  "  planWindows(s);\n"
+  "  yyrestart(in, scanner);\n"
+  "  yylex(scanner);\n"
+  "}\n"
+  "\n";
+  str += procedures();
 
-  "  yylex();\n"
+    return str;
+  }
+};
 
-  "  double reliability;\n"
-  "  for (int i=0; i < formats_num; i++){\n"
-  "    reliability = 0;\n"
-  "    for (int j=0; j < regex_num[i]; j++){\n"
-  "      reliability += formats_regex[i][j].goodness * formats_regex[i][j].matches;\n"
+
+/**
+ * @brief Generates fguess.c, a C classifier equivalent to fguess.lex (same options and reliabilities) which
+ * doesn't need flex. Instead of a rule with REJECT for each regex, it embeds the deterministic automaton of all
+ * the regexs and counts every match in a single forward pass, so its speed doesn't fall with the number of
+ * formats and regexs.
+ */
+class DfaOutputTemplate : public OutputTemplate{
+private:
+  int max_states;
+
+  template <class T>
+  static std::string arrayString(const T* array, int n){
+    std::string str = "{";
+    for (int i=0; i < n; i++){
+      str += std::to_string(array[i]);
+      str += (i+1 < n) ? "," : "";
+    }
+    return str + "}";
+  }
+
+public:
+
+  /**
+   * @param output_template Template with the expressions to classify.
+   * @param max_states Maximum number of states of the automaton.
+   */
+  DfaOutputTemplate(const OutputTemplate &output_template, int max_states = 1 << 16) : OutputTemplate(output_template), max_states(max_states){}
+
+  /**
+   * @brief Generates the C program. If the automaton exceeds the maximum number of states the program
+   * is an #error directive.
+   */
+  std::string toString(){
+    Nfa nfa;
+    Dfa dfa;
+    std::map<std::string, std::vector<std::pair<std::string, double> > >::iterator it;
+    for (it = regex_data.begin(); it != regex_data.end(); ++it)
+      for (std::vector<std::pair<std::string, double> >::iterator it2 = (*it).second.begin(); it2 != (*it).second.end(); ++it2)
+        nfa.addRegex(it2->first);
+    if (!dfa.build(nfa, max_states))
+      return "#error The automaton of the regexs has more than " + std::to_string(max_states) + " states\n";
+    dfa.minimize();
+
+    std::string dfa_states = std::to_string(dfa.states());
+    std::string dfa_start = std::to_string(dfa.start());
+    std::string dfa_classes = std::to_string(dfa.classCount());
+    std::string dfa_type = dfa.states() <= 256 ? "unsigned char" : dfa.states() <= 65536 ? "unsigned short" : "int";
+    std::string byte_class = arrayString(dfa.classes(), 256);
+    std::string dfa_next = "{\n";
+    std::vector<int> row(dfa.classCount());
+    for (int s=0; s < dfa.states(); s++){
+      for (int c=0; c < dfa.classCount(); c++)
+        row[c] = dfa.classNext(s, c);
+      dfa_next += arrayString(&row[0], row.size()) + (s+1 < dfa.states() ? ",\n" : "\n");
+    }
+    dfa_next += "}";
+    std::string match_first = arrayString(dfa.matchFirst(), dfa.states()+1);
+    int match_ids_num = dfa.matchFirst()[dfa.states()];
+    std::string match_ids = match_ids_num > 0 ? arrayString(dfa.matchIds(), match_ids_num) : "{-1}";
+
+    std::string str;
+    str =
+  "/* fguess classifier: a single pass of the automaton of all the regexs counts the matches of every regex */\n";
+  str += declarations();
+  str +=
+  "#define dfa_states ";
+  str += dfa_states;
+  str +=
+  " // States of the minimal automaton of all the regexs, the state 0 is the dead one\n"
+  "#define dfa_start ";
+  str += dfa_start;
+  str +=
+  "\n"
+  "#define dfa_classes ";
+  str += dfa_classes;
+  str +=
+  " // Classes of the bytes which lead every state to the same state\n"
+  "const unsigned char byte_class[256] = ";
+  str += byte_class;
+  str +=
+  ";\n"
+  "const ";
+  str += dfa_type;
+  str +=
+  " dfa_next[dfa_states][dfa_classes] = ";
+  str += dfa_next;
+  str +=
+  ";\n"
+  "const int match_first[dfa_states+1] = ";
+  str += match_first;
+  str +=
+  "; // Regexs which match in each state\n"
+  "const int match_ids[] = ";
+  str += match_ids;
+  str +=
+  ";\n"
+  "\n"
+  "// The scanner keeps how many start positions are in each state instead of restarting the automaton at every position\n"
+  "struct DfaScanner{\n"
+  "  int* slot;\n"
+  "  int* states;\n"
+  "  unsigned long* counts;\n"
+  "  int* next_states;\n"
+  "  unsigned long* next_counts;\n"
+  "};\n"
+  "typedef struct DfaScanner* Scanner;\n"
+  "Scanner newScanner(struct ScanState* s){\n"
+  "  Scanner scanner = (Scanner)malloc(sizeof(struct DfaScanner));\n"
+  "  scanner->slot = (int*)malloc(sizeof(int)*dfa_states);\n"
+  "  scanner->states = (int*)malloc(sizeof(int)*dfa_states);\n"
+  "  scanner->counts = (unsigned long*)malloc(sizeof(unsigned long)*dfa_states);\n"
+  "  scanner->next_states = (int*)malloc(sizeof(int)*dfa_states);\n"
+  "  scanner->next_counts = (unsigned long*)malloc(sizeof(unsigned long)*dfa_states);\n"
+  "  for (int i=0; i < dfa_states; i++)\n"
+  "    scanner->slot[i] = -1;\n"
+  "  return scanner;\n"
+  "}\n"
+  "\n"
+  "void freeScanner(Scanner scanner){\n"
+  "  free(scanner->slot);\n"
+  "  free(scanner->states);\n"
+  "  free(scanner->counts);\n"
+  "  free(scanner->next_states);\n"
+  "  free(scanner->next_counts);\n"
+  "  free(scanner);\n"
+  "}\n"
+  "\n"
+  "void scanFile(Scanner scanner, struct ScanState* s, FILE* in){\n"
+  "  char buf[8192];\n"
+  "  int n, t, active = 0, next_active;\n"
+  "  int* swap_states;\n"
+  "  unsigned long* swap_counts;\n"
+  "  memset(s, 0, sizeof(struct ScanState));\n"
+  "  s->in = in;\n"
+  "  planWindows(s);\n"
+  "  while ((n = readInput(s, buf, sizeof(buf))) > 0)\n"
+  "    for (int i=0; i < n; i++){\n"
+  "      unsigned char c = byte_class[(unsigned char)buf[i]];\n"
+  "      next_active = 0;\n"
+  "      t = dfa_next[dfa_start][c];\n"
+  "      if (t != 0){\n"
+  "        scanner->slot[t] = next_active;\n"
+  "        scanner->next_states[next_active] = t;\n"
+  "        scanner->next_counts[next_active++] = 1;\n"
+  "      }\n"
+  "      for (int j=0; j < active; j++){\n"
+  "        t = dfa_next[scanner->states[j]][c];\n"
+  "        if (t == 0)\n"
+  "          continue;\n"
+  "        if (scanner->slot[t] < 0){\n"
+  "          scanner->slot[t] = next_active;\n"
+  "          scanner->next_states[next_active] = t;\n"
+  "          scanner->next_counts[next_active++] = scanner->counts[j];\n"
+  "        } else scanner->next_counts[scanner->slot[t]] += scanner->counts[j];\n"
+  "      }\n"
+  "      for (int j=0; j < next_active; j++){\n"
+  "        t = scanner->next_states[j];\n"
+  "        scanner->slot[t] = -1;\n"
+  "        for (int m=match_first[t]; m < match_first[t+1]; m++)\n"
+  "          s->matches[match_ids[m]] += scanner->next_counts[j];\n"
+  "      }\n"
+  "      swap_states = scanner->states;\n"
+  "      scanner->states = scanner->next_states;\n"
+  "      scanner->next_states = swap_states;\n"
+  "      swap_counts = scanner->counts;\n"
+  "      scanner->counts = scanner->next_counts;\n"
+  "      scanner->next_counts = swap_counts;\n"
+  "      active = next_active;\n"
   "    }\n"
-  "    reliability = reliability / (reliability+100);\n"
-  "    printf(\"The file is %s whith a reliability of %lf\\n\", format_names[i], reliability);\n"
-  "  }\n"
+  "}\n"
+  "\n";
+  str += procedures();
 
-  "  for (int i=0; i < formats_num; i++)\n"
-  "    free(formats_regex[i]);\n"
-  "  free(formats_regex);\n"
-  "  return 0;\n"
-  "}";
+    return str;
+  }
+};
+
+
+/**
+ * @brief Generates the fguess.model file with the same expressions and goodness as fguess.lex, which is
+ * loaded by the classifier library (classifier.hpp, fguess.h).
+ */
+class ModelTemplate : public FileTemplate{
+private:
+  const OutputTemplate &output_template;
+  const Prestage* prestage;
 
-  return str;
+public:
+
+  /**
+   * @param output_template Template whose expressions are written in the model.
+   * @param prestage Byte distributions of the formats written after the expressions, or NULL to omit them.
+   */
+  ModelTemplate(const OutputTemplate &output_template, const Prestage* prestage = NULL) : output_template(output_template), prestage(prestage){}
+
+  /**
+   * @brief Writes a line with the number of formats and, for every format, a line with its number of
+   * expressions and its name followed by a line for each expression with its goodness. The goodness keeps
+   * the precision of fguess.lex so every classifier obtains the same reliabilities.
+   */
+  std::string toString(){
+    const std::map<std::string, std::vector<std::pair<std::string, double> > > &regex_data = output_template.regexData();
+    std::string str = "fguess model\n";
+    str += "formats " + std::to_string(regex_data.size()) + "\n";
+    std::map<std::string, std::vector<std::pair<std::string, double> > >::const_iterator it;
+    for (it = regex_data.begin(); it != regex_data.end(); ++it){
+      str += "format " + std::to_string(it->second.size()) + " " + it->first + "\n";
+      for (std::vector<std::pair<std::string, double> >::const_iterator it2 = it->second.begin(); it2 != it->second.end(); ++it2)
+        str += std::to_string(it2->second) + " " + it2->first + "\n";
+    }
+    if (prestage != NULL && !prestage->empty())
+      str += prestage->toString();
+    return str;
   }
 };
 
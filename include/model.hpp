@@ -0,0 +1,122 @@
+/**
+ * @file model.hpp
+ * @brief Trained model: the expressions of every format alongside their goodness
+ */
+
+#ifndef _MODEL_H_
+#define _MODEL_H_
+
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include "prestage.hpp"
+
+
+
+/**
+ * @brief Expressions and goodness of every format, as written by ModelTemplate in the fguess.model file.
+ * The formats and the expressions keep the order of the fguess.lex rules. Models written since the
+ * prestage was added also keep the byte distribution of every format after the expressions.
+ */
+class Model{
+private:
+  std::vector<std::string> m_format_names;
+  std::vector<std::vector<std::pair<std::string, double> > > m_regexs;
+  Prestage m_prestage;
+
+public:
+
+  /**
+   * @brief Reads a model file.
+   * @param filename Path of the model written by the training.
+   * @return false if the file can't be opened or isn't a model.
+   */
+  bool load(const std::string &filename){
+    std::ifstream ifs(filename.c_str());
+    std::string line;
+    int formats = 0, regexs = 0;
+
+    m_format_names.clear();
+    m_regexs.clear();
+    m_prestage = Prestage();
+    if (!std::getline(ifs, line) || line != "fguess model")
+      return false;
+    if (!std::getline(ifs, line) || sscanf(line.c_str(), "formats %d", &formats) != 1)
+      return false;
+    for (int i=0; i < formats; i++){
+      size_t name_pos;
+      if (!std::getline(ifs, line) || sscanf(line.c_str(), "format %d", &regexs) != 1)
+        return false;
+      name_pos = line.find(' ', 7);
+      if (name_pos == std::string::npos)
+        return false;
+      m_format_names.push_back(line.substr(name_pos+1));
+      m_regexs.push_back(std::vector<std::pair<std::string, double> >());
+      for (int j=0; j < regexs; j++){
+        size_t regex_pos;
+        if (!std::getline(ifs, line) || (regex_pos = line.find(' ')) == std::string::npos)
+          return false;
+        m_regexs.back().push_back(std::pair<std::string, double>(line.substr(regex_pos+1), strtod(line.c_str(), NULL)));
+      }
+    }
+    // The prestage is optional, older models end after the expressions
+    if (ifs.peek() != std::ifstream::traits_type::eof() && !m_prestage.read(ifs))
+      return false;
+    return true;
+  }
+
+  /**
+   * @brief Adds an expression to a format. The formats are kept in the order of their first expression.
+   */
+  void addRegex(const std::string &format_name, const std::string &regex, double goodness){
+    if (m_format_names.empty() || m_format_names.back() != format_name){
+      m_format_names.push_back(format_name);
+      m_regexs.push_back(std::vector<std::pair<std::string, double> >());
+    }
+    m_regexs.back().push_back(std::pair<std::string, double>(regex, goodness));
+  }
+
+  /**
+   * @brief Returns the number of formats.
+   */
+  int formats() const{
+    return m_format_names.size();
+  }
+
+  const std::string& formatName(int i) const{
+    return m_format_names[i];
+  }
+
+  /**
+   * @brief Returns the expressions of a format alongside their goodness.
+   */
+  const std::vector<std::pair<std::string, double> >& regexs(int i) const{
+    return m_regexs[i];
+  }
+
+  void setPrestage(const Prestage &prestage){
+    m_prestage = prestage;
+  }
+
+  /**
+   * @brief Returns the byte distributions of the formats, which is empty if the model has none.
+   */
+  const Prestage& prestage() const{
+    return m_prestage;
+  }
+
+  /**
+   * @brief Returns the number of expressions of all the formats.
+   */
+  int regexsNum() const{
+    int n = 0;
+    for (int i=0; i < formats(); i++)
+      n += m_regexs[i].size();
+    return n;
+  }
+};
+
+#endif
@@ -0,0 +1,326 @@
+/**
+ * @file ngram_stats.hpp
+ * @brief Frequencies of byte n-grams and words which tell a format apart from the rest
+ */
+
+#ifndef _NGRAM_STATS_H_
+#define _NGRAM_STATS_H_
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+
+/**
+ * @brief Counts the byte n-grams (up to max_n bytes) and the words of the files of a format and of the rest
+ * of formats, and scores the expressions built from them with the goodness of the training. The count of
+ * an n-gram is the number of its occurrences, overlapped or not, which is the number of matches the counting
+ * scanners give for the literal.
+ */
+class NgramStats{
+public:
+
+  /**
+   * @brief Expression found by the statistics, as a sequence of atoms, and its goodness.
+   */
+  struct Candidate{
+    std::vector<std::string> atoms;
+    double goodness;
+  };
+
+  static const int max_n = 4;
+  static const size_t max_word_length = 32;
+
+private:
+
+  struct Counts{
+    std::vector<uint64_t> short_ngrams;               // 1 byte n-grams at their byte, 2 bytes ones at 256 + bytes
+    std::unordered_map<uint64_t, uint64_t> ngrams;   // Longer ones. Key: length << 32 | bytes
+    std::unordered_map<std::string, uint64_t> words;
+    uint64_t chars;
+
+    Counts() : short_ngrams(256 + 65536, 0){
+      chars = 0;
+    }
+
+    void merge(const Counts &counts){
+      for (size_t i=0; i < short_ngrams.size(); i++)
+        short_ngrams[i] += counts.short_ngrams[i];
+      for (std::unordered_map<uint64_t, uint64_t>::const_iterator it = counts.ngrams.begin(); it != counts.ngrams.end(); ++it)
+        ngrams[it->first] += it->second;
+      for (std::unordered_map<std::string, uint64_t>::const_iterator it = counts.words.begin(); it != counts.words.end(); ++it)
+        words[it->first] += it->second;
+      chars += counts.chars;
+    }
+  };
+
+  Counts m_counts[2];   // Current format and rest of formats
+
+  static bool isWhitespace(unsigned char c){
+    return c == ' ' || (c >= '\t' && c <= '\r');
+  }
+
+  /**
+   * @brief Adds the n-grams and words of a file.
+   * @return false if the file can't be read.
+   */
+  static bool count(const std::string &path, Counts &counts){
+    static const uint32_t masks[max_n+1] = {0, 0xff, 0xffff, 0xffffff, 0xffffffff};
+    std::vector<unsigned char> buffer(1 << 16);
+    std::string word;
+    uint32_t window = 0;
+    int available = 0;
+    ssize_t length;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    while ((length = read(fd, &buffer[0], buffer.size())) > 0){
+      counts.chars += length;
+      for (ssize_t i=0; i < length; i++){
+        unsigned char c = buffer[i];
+        window = (window << 8) | c;
+        if (available < max_n) available++;
+        counts.short_ngrams[c]++;
+        if (available >= 2)
+          counts.short_ngrams[256 + (window & 0xffff)]++;
+        for (int n=3; n <= available; n++)
+          counts.ngrams[((uint64_t)n << 32) | (window & masks[n])]++;
+        if (isWhitespace(c)){
+          if (!word.empty() && word.size() <= max_word_length)
+            counts.words[word]++;
+          word.clear();
+        } else if (word.size() <= max_word_length){
+          word.push_back(c);
+        }
+      }
+    }
+    if (!word.empty() && word.size() <= max_word_length)
+      counts.words[word]++;
+    close(fd);
+    return length == 0;
+  }
+
+  /**
+   * @brief Returns the expression which matches literally the bytes of str.
+   */
+  static std::string literal(const std::string &str){
+    std::string regex = "\"";
+    char code[8];
+    for (size_t i=0; i < str.size(); i++){
+      unsigned char c = str[i];
+      if (c == '"' || c == '\\'){
+        regex += '\\';
+        regex += c;
+      } else if (c == '\n'){
+        regex += "\\n";
+      } else if (c == '\t'){
+        regex += "\\t";
+      } else if (c < 0x20 || c >= 0x7f){
+        snprintf(code, sizeof(code), "\\x%02x", c);
+        regex += code;
+      } else {
+        regex += c;
+      }
+    }
+    return regex + "\"";
+  }
+
+  static std::string ngramString(uint64_t key){
+    int n = key >> 32;
+    std::string str(n, ' ');
+    for (int i=0; i < n; i++)
+      str[i] = (key >> (8*(n-1-i))) & 0xff;
+    return str;
+  }
+
+  /**
+   * @brief The goodness formula of select_fittest.
+   */
+  double goodness(uint64_t current_matches, uint64_t other_matches) const{
+    double current_mean = (double)current_matches / (m_counts[0].chars > 0 ? m_counts[0].chars : 1);
+    double other_mean = (double)other_matches / (m_counts[1].chars > 0 ? m_counts[1].chars : 1);
+    return current_mean / (1000*other_mean + 1);
+  }
+
+  /**
+   * @brief Returns the occurrences of an n-gram in the format (0) or in the rest of formats (1).
+   */
+  uint64_t ngramCount(int corpus, uint64_t key) const{
+    int n = key >> 32;
+    if (n <= 2)
+      return m_counts[corpus].short_ngrams[(n == 1 ? 0 : 256) + (key & 0xffff)];
+    std::unordered_map<uint64_t, uint64_t>::const_iterator it = m_counts[corpus].ngrams.find(key);
+    return it == m_counts[corpus].ngrams.end() ? 0 : it->second;
+  }
+
+  /**
+   * @brief Returns the n-grams which appear in the format (0) or in the rest of formats (1), with their occurrences.
+   */
+  std::vector<std::pair<uint64_t, uint64_t> > ngramCounts(int corpus) const{
+    std::vector<std::pair<uint64_t, uint64_t> > counts;
+    const std::vector<uint64_t> &short_ngrams = m_counts[corpus].short_ngrams;
+    for (size_t i=0; i < short_ngrams.size(); i++)
+      if (short_ngrams[i] > 0)
+        counts.push_back(std::pair<uint64_t, uint64_t>(i < 256 ? (1ULL << 32) | i : (2ULL << 32) | (i - 256), short_ngrams[i]));
+    counts.insert(counts.end(), m_counts[corpus].ngrams.begin(), m_counts[corpus].ngrams.end());
+    return counts;
+  }
+
+  /**
+   * @brief Returns the key of the character class pattern of an n-gram: 9 bits per byte, which are the byte
+   * itself or 256, 257 and 258 for lowercase letters, uppercase letters and digits.
+   */
+  static uint64_t patternKey(uint64_t key){
+    int n = key >> 32;
+    uint64_t pattern = (uint64_t)n << 36;
+    for (int i=0; i < n; i++){
+      unsigned char c = (key >> (8*(n-1-i))) & 0xff;
+      uint64_t code = c;
+      if (c >= 'a' && c <= 'z') code = 256;
+      else if (c >= 'A' && c <= 'Z') code = 257;
+      else if (c >= '0' && c <= '9') code = 258;
+      pattern |= code << (9*(n-1-i));
+    }
+    return pattern;
+  }
+
+  static std::vector<std::string> patternAtoms(uint64_t pattern){
+    static const char* classes[] = {"[a-z]", "[A-Z]", "[0-9]"};
+    int n = pattern >> 36;
+    std::vector<std::string> atoms;
+    for (int i=0; i < n; i++){
+      int code = (pattern >> (9*(n-1-i))) & 0x1ff;
+      atoms.push_back(code >= 256 ? std::string(classes[code-256]) : literal(std::string(1, (char)code)));
+    }
+    return atoms;
+  }
+
+  static bool hasClass(uint64_t pattern){
+    for (int i=0; i < (int)(pattern >> 36); i++)
+      if (((pattern >> (9*i)) & 0x1ff) >= 256)
+        return true;
+    return false;
+  }
+
+public:
+
+  /**
+   * @brief Counts the n-grams and words of the files in one pass, sharing the files between threads.
+   * @param current_paths Files of the format.
+   * @param other_paths Files of the rest of formats.
+   * @param threads Number of threads.
+   * @return false if a file can't be read.
+   */
+  bool build(const std::vector<std::string> &current_paths, const std::vector<std::string> &other_paths, int threads){
+    std::vector<std::pair<int, std::string> > files;
+    for (size_t i=0; i < current_paths.size(); i++)
+      files.push_back(std::pair<int, std::string>(0, current_paths[i]));
+    for (size_t i=0; i < other_paths.size(); i++)
+      files.push_back(std::pair<int, std::string>(1, other_paths[i]));
+    if (threads < 1) threads = 1;
+    if ((size_t)threads > files.size()) threads = std::max<size_t>(files.size(), 1);
+
+    std::vector<Counts> partial(2*threads);
+    std::vector<char> ok(threads, 1);
+    std::vector<std::thread> workers;
+    for (int t=0; t < threads; t++)
+      workers.push_back(std::thread([&, t]{
+        for (size_t i=t; i < files.size(); i += threads)
+          if (!count(files[i].second, partial[2*t + files[i].first]))
+            ok[t] = 0;
+      }));
+    m_counts[0] = Counts();
+    m_counts[1] = Counts();
+    for (int t=0; t < threads; t++){
+      workers[t].join();
+      m_counts[0].merge(partial[2*t]);
+      m_counts[1].merge(partial[2*t+1]);
+    }
+    return std::find(ok.begin(), ok.end(), 0) == ok.end();
+  }
+
+  /**
+   * @brief Returns the expressions with the best goodness among the n-grams of the format, the patterns which
+   * replace their letters and digits by classes, and its words longer than max_n.
+   * @param n Maximum number of expressions.
+   */
+  std::vector<Candidate> best(size_t n) const{
+    // Goodness, kind (0 n-gram, 1 pattern, 2 word) and n-gram or pattern key or word of every candidate
+    struct Scored{
+      double goodness;
+      int kind;
+      uint64_t key;
+      const std::string* word;
+      bool operator<(const Scored &scored) const{
+        if (goodness != scored.goodness) return goodness > scored.goodness;
+        if (kind != scored.kind) return kind < scored.kind;
+        if (kind == 2) return *word < *scored.word;
+        return key < scored.key;
+      }
+    };
+    std::vector<Scored> scored;
+    std::unordered_map<uint64_t, std::pair<uint64_t, uint64_t> > patterns;
+
+    std::vector<std::pair<uint64_t, uint64_t> > current_ngrams = ngramCounts(0);
+    for (size_t i=0; i < current_ngrams.size(); i++){
+      uint64_t key = current_ngrams[i].first;
+      if (ngramString(key).find('\0') == std::string::npos){
+        Scored candidate = {goodness(current_ngrams[i].second, ngramCount(1, key)), 0, key, NULL};
+        scored.push_back(candidate);
+      }
+      // The matches of a pattern are the occurrences of every n-gram which fits it
+      uint64_t pattern = patternKey(key);
+      if (hasClass(pattern))
+        patterns[pattern].first += current_ngrams[i].second;
+    }
+    std::vector<std::pair<uint64_t, uint64_t> > other_ngrams = ngramCounts(1);
+    for (size_t i=0; i < other_ngrams.size(); i++){
+      std::unordered_map<uint64_t, std::pair<uint64_t, uint64_t> >::iterator it = patterns.find(patternKey(other_ngrams[i].first));
+      if (it != patterns.end())
+        it->second.second += other_ngrams[i].second;
+    }
+    for (std::unordered_map<uint64_t, std::pair<uint64_t, uint64_t> >::iterator it = patterns.begin(); it != patterns.end(); ++it){
+      Scored candidate = {goodness(it->second.first, it->second.second), 1, it->first, NULL};
+      scored.push_back(candidate);
+    }
+    // Words are scored by their counts as whole words, which approximates their matches
+    for (std::unordered_map<std::string, uint64_t>::const_iterator it = m_counts[0].words.begin(); it != m_counts[0].words.end(); ++it){
+      if (it->first.size() <= (size_t)max_n || it->first.find('\0') != std::string::npos)
+        continue;
+      std::unordered_map<std::string, uint64_t>::const_iterator other = m_counts[1].words.find(it->first);
+      Scored candidate = {goodness(it->second, other == m_counts[1].words.end() ? 0 : other->second), 2, 0, &it->first};
+      scored.push_back(candidate);
+    }
+
+    // The literals of different n-grams and words, and the patterns, are all different expressions
+    n = std::min(n, scored.size());
+    std::partial_sort(scored.begin(), scored.begin() + n, scored.end());
+    std::vector<Candidate> selected(n);
+    for (size_t i=0; i < n; i++){
+      selected[i].goodness = scored[i].goodness;
+      if (scored[i].kind == 0)
+        selected[i].atoms.push_back(literal(ngramString(scored[i].key)));
+      else if (scored[i].kind == 1)
+        selected[i].atoms = patternAtoms(scored[i].key);
+      else
+        selected[i].atoms.push_back(literal(*scored[i].word));
+    }
+    return selected;
+  }
+
+  /**
+   * @brief Returns the bytes read of the format (0) or of the rest of formats (1).
+   */
+  uint64_t chars(int corpus) const{
+    return m_counts[corpus].chars;
+  }
+};
+
+#endif
@@ -0,0 +1,194 @@
+/**
+ * @file prestage.hpp
+ * @brief Byte histogram stage which discards unlikely formats before scanning with the expressions
+ */
+
+#ifndef _PRESTAGE_H_
+#define _PRESTAGE_H_
+
+#include <istream>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+
+/**
+ * @brief Byte distribution of every format. A buffer whose prefix is much less likely under the
+ * distribution of a format than any of its training files can't be of that format, so the classifier
+ * doesn't scan it with the expressions of that format.
+ */
+class Prestage{
+private:
+  int m_prefix;
+  std::vector<std::string> m_names;
+  std::vector<double> m_floors;
+  std::vector<std::vector<double> > m_log_probabilities;
+
+public:
+
+  /**
+   * @brief Default number of bytes of the prefix whose histogram is compared.
+   */
+  static const int default_prefix = 4096;
+
+  /**
+   * @brief Margin, in nats per byte, below the least likely training file of a format.
+   */
+  static constexpr double slack = 1.0;
+
+  Prestage(){
+    m_prefix = default_prefix;
+  }
+
+  /**
+   * @brief Counts the bytes of a buffer. Four tables are filled in turns, so consecutive equal bytes don't
+   * wait for each other's increment, and added at the end.
+   * @param histogram Array of 256 counters where the counts are written.
+   */
+  static void histogram(const unsigned char* data, size_t length, uint32_t* histogram){
+    uint32_t tables[4][256] = {{0}};
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4){
+      tables[0][data[i]]++;
+      tables[1][data[i+1]]++;
+      tables[2][data[i+2]]++;
+      tables[3][data[i+3]]++;
+    }
+    for (; i < length; i++)
+      tables[0][data[i]]++;
+    for (int b=0; b < 256; b++)
+      histogram[b] = tables[0][b] + tables[1][b] + tables[2][b] + tables[3][b];
+  }
+
+  /**
+   * @brief Returns the mean log-probability per byte of a histogram under the distribution of a format.
+   */
+  double logLikelihood(int format, const uint32_t* histogram, size_t length) const{
+    double log_likelihood = 0;
+    for (int b=0; b < 256; b++)
+      log_likelihood += histogram[b] * m_log_probabilities[format][b];
+    return length > 0 ? log_likelihood / length : 0;
+  }
+
+  /**
+   * @brief Learns the byte distribution of a format, with add-one smoothing, and the likelihood floor from
+   * the prefixes of its files.
+   * @param name Name of the format.
+   * @param files Contents of the training files of the format.
+   */
+  void addFormat(const std::string &name, const std::vector<std::string> &files){
+    uint32_t counts[256], file_counts[256];
+    double total = 256;
+    std::vector<double> counts_sum(256, 1);
+    for (size_t i=0; i < files.size(); i++){
+      histogram((const unsigned char*)files[i].data(), files[i].size(), counts);
+      for (int b=0; b < 256; b++)
+        counts_sum[b] += counts[b];
+      total += files[i].size();
+    }
+    m_names.push_back(name);
+    m_log_probabilities.push_back(std::vector<double>(256));
+    for (int b=0; b < 256; b++)
+      m_log_probabilities.back()[b] = log(counts_sum[b] / total);
+
+    double floor = 0;
+    bool first = true;
+    for (size_t i=0; i < files.size(); i++){
+      size_t length = files[i].size() < (size_t)m_prefix ? files[i].size() : m_prefix;
+      if (length == 0)
+        continue;
+      histogram((const unsigned char*)files[i].data(), length, file_counts);
+      double log_likelihood = logLikelihood(m_names.size()-1, file_counts, length);
+      if (first || log_likelihood < floor)
+        floor = log_likelihood;
+      first = false;
+    }
+    m_floors.push_back(floor - slack);
+  }
+
+  bool empty() const{
+    return m_names.empty();
+  }
+
+  int formats() const{
+    return m_names.size();
+  }
+
+  const std::string& formatName(int i) const{
+    return m_names[i];
+  }
+
+  /**
+   * @brief Marks the formats whose distribution can explain the prefix of a buffer.
+   * @param keep Vector of formats() elements where 1 is written for the plausible formats and 0 for the rest.
+   */
+  void candidates(const char* data, size_t length, std::vector<char> &keep) const{
+    uint32_t counts[256];
+    if (length > (size_t)m_prefix)
+      length = m_prefix;
+    keep.assign(formats(), 1);
+    if (length == 0)
+      return;
+    histogram((const unsigned char*)data, length, counts);
+    for (int i=0; i < formats(); i++)
+      keep[i] = logLikelihood(i, counts, length) >= m_floors[i];
+  }
+
+  /**
+   * @brief Returns the stage as the section of the model file which follows the expressions: a line with
+   * the prefix and the number of formats and, for every format, a line with its floor and name followed by
+   * a line with the 256 log-probabilities.
+   */
+  std::string toString() const{
+    char number[32];
+    std::string str = "prestage " + std::to_string(m_prefix) + " " + std::to_string(formats()) + "\n";
+    for (int i=0; i < formats(); i++){
+      snprintf(number, sizeof(number), "%.17g", m_floors[i]);
+      str += std::string(number) + " " + m_names[i] + "\n";
+      for (int b=0; b < 256; b++){
+        snprintf(number, sizeof(number), "%.17g", m_log_probabilities[i][b]);
+        str += (b > 0 ? " " : "") + std::string(number);
+      }
+      str += "\n";
+    }
+    return str;
+  }
+
+  /**
+   * @brief Reads the section written by toString.
+   * @return false if the section is malformed.
+   */
+  bool read(std::istream &is){
+    std::string line;
+    int formats_num;
+    Prestage prestage;
+    if (!std::getline(is, line) || sscanf(line.c_str(), "prestage %d %d", &prestage.m_prefix, &formats_num) != 2 || prestage.m_prefix <= 0)
+      return false;
+    for (int i=0; i < formats_num; i++){
+      size_t name_pos;
+      if (!std::getline(is, line) || (name_pos = line.find(' ')) == std::string::npos)
+        return false;
+      prestage.m_floors.push_back(strtod(line.c_str(), NULL));
+      prestage.m_names.push_back(line.substr(name_pos+1));
+      if (!std::getline(is, line))
+        return false;
+      prestage.m_log_probabilities.push_back(std::vector<double>(256));
+      const char* pos = line.c_str();
+      for (int b=0; b < 256; b++){
+        char* end;
+        prestage.m_log_probabilities.back()[b] = strtod(pos, &end);
+        if (end == pos)
+          return false;
+        pos = end;
+      }
+    }
+    *this = prestage;
+    return true;
+  }
+};
+
+#endif
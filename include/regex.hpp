@@ -6,16 +6,71 @@
 #ifndef _REGEX_H_
 #define _REGEX_H_
 
+#include <ostream>
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "arena.hpp"
 
 
 
 /**
- * @brief Allows manage indivisibly expressions with more than one character.
+ * @brief Table with the string of every atomic expression. Each different string is stored only once and
+ * the expressions refer to it by its index. The table isn't thread safe: atoms must be interned from a
+ * single thread at a time.
+ */
+class AtomTable{
+private:
+  std::vector<std::string> m_strings;
+  std::unordered_map<std::string, uint32_t> m_ids;
+
+public:
+
+  AtomTable(){
+    intern("");
+  }
+
+  /**
+   * @brief Returns the index of a string, adding it to the table the first time.
+   */
+  uint32_t intern(const std::string &str){
+    std::unordered_map<std::string, uint32_t>::iterator it = m_ids.find(str);
+    if (it != m_ids.end())
+      return it->second;
+    m_strings.push_back(str);
+    m_ids[str] = m_strings.size() - 1;
+    return m_strings.size() - 1;
+  }
+
+  const std::string& string(uint32_t id) const{
+    return m_strings[id];
+  }
+
+  size_t size() const{
+    return m_strings.size();
+  }
+
+  /**
+   * @brief Returns the table of the program.
+   */
+  static AtomTable& global(){
+    static AtomTable table;
+    return table;
+  }
+};
+
+
+/**
+ * @brief Allows manage indivisibly expressions with more than one character. It only keeps the index of
+ * its string in the AtomTable, so copying and comparing atoms is as cheap as for an integer.
  */
 class AtomicRegex{
 private:
-  std::string m_str;
+  uint32_t m_id;
 
 public:
 
@@ -23,7 +78,7 @@ public:
    * @brief Builds an empty regex.
    */
   AtomicRegex(){
-    m_str = "";
+    m_id = 0;
   }
 
   /**
@@ -31,72 +86,181 @@ public:
    * @param str String which describes the regex.
    */
   AtomicRegex(const std::string &str){
-    m_str = str;
+    m_id = AtomTable::global().intern(str);
   }
 
-  ~AtomicRegex(){}
-
   /**
    * @brief Returns the regex string representation.
    */
-  std::string toString() const{
-    return m_str;
+  const std::string& toString() const{
+    return AtomTable::global().string(m_id);
+  }
+
+  /**
+   * @brief Returns the index of the regex string in the AtomTable.
+   */
+  uint32_t id() const{
+    return m_id;
   }
 
   bool operator==(const AtomicRegex &atomic) const{
-    return m_str == atomic.m_str;
+    return m_id == atomic.m_id;
   }
 
-  friend std::ostream& operator<<(std::ostream& os, AtomicRegex& regex);
+  friend std::ostream& operator<<(std::ostream& os, const AtomicRegex& regex);
 };
 
-std::ostream& operator<<(std::ostream& os, AtomicRegex& regex){
-    os << regex.toString();
+std::ostream& operator<<(std::ostream& os, const AtomicRegex& regex){
+  os << regex.toString();
+  return os;
 }
 
 
 /**
- * @brief Regular expresion composed by several AtomicRegex
+ * @brief Regular expresion composed by several AtomicRegex. The atoms are stored contiguously inside the
+ * object while they fit in inline_length (which makes a Regex 64 bytes long), so the genetic operations
+ * don't allocate memory in the usual case. Longer expressions take their atoms from the arena set with
+ * useArena, if any, or from the heap.
  */
 class Regex{
 private:
+  static const int inline_length = 11;
   AtomicRegex* m_atomics;
   int m_length;
+  int m_capacity;
+  AtomicRegex m_inline[inline_length];
+  bool m_in_arena;
+
+  static Arena*& arena(){
+    static Arena* current = NULL;
+    return current;
+  }
+
+  /**
+   * @brief Makes room for n atoms, discarding the current ones.
+   */
+  void allocate(int n){
+    if (n > m_capacity){
+      release();
+      if (arena() != NULL){
+        m_atomics = (AtomicRegex*)arena()->allocate(n * sizeof(AtomicRegex));
+        m_in_arena = true;
+      } else {
+        m_atomics = new AtomicRegex[n];
+      }
+      m_capacity = n;
+    }
+    m_length = n;
+  }
+
+  void release(){
+    if (m_atomics != m_inline && !m_in_arena)
+      delete[] m_atomics;
+    m_atomics = m_inline;
+    m_capacity = inline_length;
+    m_in_arena = false;
+  }
+
+  /**
+   * @brief Takes the atoms of regex, which is left empty. The atoms of this must be already released.
+   */
+  void steal(Regex &regex){
+    m_length = regex.m_length;
+    if (regex.m_atomics == regex.m_inline){
+      memcpy(m_inline, regex.m_inline, m_length * sizeof(AtomicRegex));
+    } else {
+      m_atomics = regex.m_atomics;
+      m_capacity = regex.m_capacity;
+      m_in_arena = regex.m_in_arena;
+      regex.m_atomics = regex.m_inline;
+      regex.m_capacity = inline_length;
+      regex.m_in_arena = false;
+    }
+    regex.m_length = 0;
+  }
+
+  /**
+   * @brief Builds the concatenation of the atoms of several expressions.
+   */
+  Regex(const Regex* const* regexs, int n){
+    int length = 0;
+    m_atomics = m_inline;
+    m_capacity = inline_length;
+    m_in_arena = false;
+    for (int i=0; i < n; i++)
+      length += regexs[i]->m_length;
+    allocate(length);
+    length = 0;
+    for (int i=0; i < n; i++){
+      memcpy(m_atomics + length, regexs[i]->m_atomics, regexs[i]->m_length * sizeof(AtomicRegex));
+      length += regexs[i]->m_length;
+    }
+  }
+
+  /**
+   * @brief Returns the expression of a single operator, interned only once.
+   */
+  static const Regex& symbol(char c){
+    static const Regex open("("), close(")"), alternative("|"), star("*"), plus("+");
+    switch (c){
+      case '(': return open;
+      case ')': return close;
+      case '|': return alternative;
+      case '*': return star;
+      default: return plus;
+    }
+  }
 
 public:
 
   Regex(const Regex &regex){
-    m_length = regex.m_length;
-    m_atomics = new AtomicRegex[m_length];
-    for (int i=0; i < m_length; i++)
-      m_atomics[i] = regex.m_atomics[i];
+    m_atomics = m_inline;
+    m_capacity = inline_length;
+    m_in_arena = false;
+    allocate(regex.m_length);
+    memcpy(m_atomics, regex.m_atomics, m_length * sizeof(AtomicRegex));
+  }
+
+  Regex(Regex &&regex) noexcept{
+    m_atomics = m_inline;
+    m_capacity = inline_length;
+    m_in_arena = false;
+    steal(regex);
   }
 
   Regex& operator=(const Regex &regex){
-    m_length = regex.m_length;
-    m_atomics = new AtomicRegex[m_length];
-    for (int i=0; i < m_length; i++)
-      m_atomics[i] = regex.m_atomics[i];
+    if (this != &regex){
+      allocate(regex.m_length);
+      memcpy(m_atomics, regex.m_atomics, m_length * sizeof(AtomicRegex));
+    }
     return *this;
   }
 
-  bool operator==(const Regex &regex) const{
-    if (m_length != regex.m_length)
-      return false;
-
-    bool eq = true;
-    for (int i=0; i < m_length && eq; i++)
-      eq = m_atomics[i] == regex.m_atomics[i];
+  Regex& operator=(Regex &&regex) noexcept{
+    if (this == &regex)
+      return *this;
+    if (regex.m_atomics == regex.m_inline){
+      *this = static_cast<const Regex&>(regex);
+      regex.m_length = 0;
+    } else {
+      release();
+      steal(regex);
+    }
+    return *this;
+  }
 
-    return eq;
+  bool operator==(const Regex &regex) const{
+    return m_length == regex.m_length && memcmp(m_atomics, regex.m_atomics, m_length * sizeof(AtomicRegex)) == 0;
   }
 
   /**
    * @brief Builds an empty expression.
    */
   Regex(){
-    m_atomics = 0;
+    m_atomics = m_inline;
     m_length = 0;
+    m_capacity = inline_length;
+    m_in_arena = false;
   }
 
   /**
@@ -105,10 +269,11 @@ public:
    * @param n Length of the atomics vector.
    */
   Regex(const AtomicRegex* atomics, int n){
-    m_atomics = new AtomicRegex[n];
-    m_length = n;
-    for (int i=0; i < n; i++)
-      m_atomics[i] = atomics[i];
+    m_atomics = m_inline;
+    m_capacity = inline_length;
+    m_in_arena = false;
+    allocate(n);
+    memcpy(m_atomics, atomics, n * sizeof(AtomicRegex));
   }
 
   /**
@@ -117,8 +282,10 @@ public:
    * @param n Length of the strings vector.
    */
   Regex(const std::string* strings, int n){
-    m_atomics = new AtomicRegex[n];
-    m_length = n;
+    m_atomics = m_inline;
+    m_capacity = inline_length;
+    m_in_arena = false;
+    allocate(n);
     for (int i=0; i < n; i++)
       m_atomics[i] = AtomicRegex(strings[i]);
   }
@@ -127,14 +294,16 @@ public:
    * @brief Builds a expression composed only by one atomic expression.
    * @param str Atomic expression which composes the Regex in its string representation.
    */
-  Regex(const std::string str){
-    m_atomics = new AtomicRegex[1];
+  Regex(const std::string &str){
+    m_atomics = m_inline;
     m_length = 1;
+    m_capacity = inline_length;
+    m_in_arena = false;
     m_atomics[0] = AtomicRegex(str);
   }
 
   ~Regex(){
-    delete[] m_atomics;
+    release();
   }
 
   /**
@@ -156,11 +325,7 @@ public:
       return Regex();
     if (n > m_length) n = m_length;
 
-    AtomicRegex* atomics = new AtomicRegex[n];
-    int p = m_length - n;
-    for (int i=0; i < n; i++)
-      atomics[i] = m_atomics[p+i];
-    return Regex(atomics, n);
+    return Regex(m_atomics + m_length - n, n);
   }
 
   /**
@@ -174,49 +339,74 @@ public:
    * @brief Returns the Regex resulting from concatenate the AtomicRegex of two Regex.
    */
   Regex operator+(const Regex& regex) const{
-    AtomicRegex* atomics = new AtomicRegex[m_length + regex.m_length];
-    for (int i=0; i < m_length; i++)
-      atomics[i] = m_atomics[i];
-    for (int i=m_length; i < m_length+regex.m_length; i++)
-      atomics[i] = regex.m_atomics[i-m_length];
-    Regex concat_regex(atomics, m_length + regex.m_length);
-    delete[] atomics;
-    return concat_regex;
+    const Regex* parts[] = {this, &regex};
+    return Regex(parts, 2);
   }
 
   /**
    * @brief Returns the Regex resulting from add the | (or) operator between two expressions.
    */
   Regex operator|(const Regex& regex) const{
-    return Regex("(") + *this + Regex("|") + regex + Regex(")");
+    const Regex* parts[] = {&symbol('('), this, &symbol('|'), &regex, &symbol(')')};
+    return Regex(parts, 5);
   }
 
   /**
    * @brief Returns the Regex resulting from the concatenation operation between two regular expressions.
    */
   Regex operator*(const Regex& regex) const{
-    return Regex("(") + *this + regex + Regex(")");
+    const Regex* parts[] = {&symbol('('), this, &regex, &symbol(')')};
+    return Regex(parts, 4);
   }
 
   /**
    * @brief Returns the Regex with the * operator (clausure) to the Regex.
    */
   Regex operator*() const{
-    return Regex("(") + *this + Regex(")") + Regex("*");
+    const Regex* parts[] = {&symbol('('), this, &symbol(')'), &symbol('*')};
+    return Regex(parts, 4);
   }
 
   /**
    * @brief Returns the Regex with the + operator (clausure without empty word) to the Regex.
    */
   Regex operator++(int n) const{
-    return Regex("(") + *this + Regex(")") + Regex("+");
+    const Regex* parts[] = {&symbol('('), this, &symbol(')'), &symbol('+')};
+    return Regex(parts, 4);
+  }
+
+  /**
+   * @brief Sets the arena of the atoms of the expressions built from now on which don't fit inside the
+   * object. Those expressions must be destroyed or relocated before the arena is reset.
+   * @param new_arena Arena to use, or NULL to allocate from the heap.
+   */
+  static void useArena(Arena* new_arena){
+    arena() = new_arena;
+  }
+
+  /**
+   * @brief Moves the atoms to a new buffer of the current arena (or the heap), so the old one isn't used
+   * anymore.
+   */
+  void relocate(){
+    if (m_atomics == m_inline)
+      return;
+    Regex copy(*this);
+    *this = std::move(copy);
+  }
+
+  /**
+   * @brief Returns the atoms of the Regex.
+   */
+  const AtomicRegex* atomics() const{
+    return m_atomics;
   }
 
   /**
    * @brief Returns the Regex string representation.
    */
   std::string toString() const{
-    std::string str = "";
+    std::string str;
     for (int i=0; i < length(); i++)
       str += m_atomics[i].toString();
     return str;
@@ -0,0 +1,341 @@
+/**
+ * @file regex_dag.hpp
+ * @brief Regular expressions stored as shared immutable nodes
+ */
+
+#ifndef _REGEX_DAG_H_
+#define _REGEX_DAG_H_
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include "regex.hpp"
+
+
+
+/**
+ * @brief Regular expression with the interface of Regex whose atoms are the leaves of a tree of immutable
+ * concatenation nodes. The nodes are hash-consed: there is a single node for each sequence of atoms, shared
+ * by every expression which contains it, so copying an expression or wrapping it in an operator creates a
+ * constant number of nodes and two expressions are equal only if they are the same node. The hash and the
+ * length of each node are computed when it is created and its string the first time it's asked.
+ * Like the AtomTable, the nodes aren't thread safe.
+ */
+class RegexDag{
+private:
+  struct Node{
+    uint64_t hash;    // Polynomial hash of the atoms, which doesn't depend on the shape of the tree
+    uint64_t power;   // hash_base^length, to hash the concatenation with another node
+    int length;
+    uint32_t atom;    // Atom of the leaves
+    Node* left;       // NULL in the leaves
+    Node* right;
+    int refs;
+    std::string* str;
+  };
+
+  static const uint64_t hash_base = 0x100000001b3ULL;
+  Node* m_node;
+
+  static std::unordered_multimap<uint64_t, Node*>& table(){
+    static std::unordered_multimap<uint64_t, Node*> nodes;
+    return nodes;
+  }
+
+  static void acquire(Node* node){
+    if (node != NULL)
+      node->refs++;
+  }
+
+  /**
+   * @brief Frees the nodes which aren't referenced anymore, without recursion so long chains are safe.
+   */
+  static void release(Node* node){
+    if (node == NULL || --node->refs > 0)
+      return;
+    std::vector<Node*> pending(1, node);
+    node->refs++;
+    while (!pending.empty()){
+      node = pending.back();
+      pending.pop_back();
+      if (--node->refs > 0)
+        continue;
+      std::pair<std::unordered_multimap<uint64_t, Node*>::iterator, std::unordered_multimap<uint64_t, Node*>::iterator> range = table().equal_range(node->hash);
+      for (std::unordered_multimap<uint64_t, Node*>::iterator it = range.first; it != range.second; ++it)
+        if (it->second == node){
+          table().erase(it);
+          break;
+        }
+      if (node->left != NULL){
+        pending.push_back(node->left);
+        pending.push_back(node->right);
+      }
+      delete node->str;
+      delete node;
+    }
+  }
+
+  /**
+   * @brief Writes the atoms of a node in order.
+   */
+  static void atoms(const Node* node, std::vector<uint32_t> &out){
+    std::vector<const Node*> pending(1, node);
+    out.clear();
+    while (!pending.empty()){
+      node = pending.back();
+      pending.pop_back();
+      if (node->left == NULL){
+        out.push_back(node->atom);
+      } else {
+        pending.push_back(node->right);
+        pending.push_back(node->left);
+      }
+    }
+  }
+
+  static bool sameAtoms(const Node* node1, const Node* node2){
+    static std::vector<uint32_t> atoms1, atoms2;
+    if (node1->left == NULL || node2->left == NULL)
+      return node1->left == NULL && node2->left == NULL && node1->atom == node2->atom;
+    if (node1->left == node2->left && node1->right == node2->right)
+      return true;
+    atoms(node1, atoms1);
+    atoms(node2, atoms2);
+    return atoms1 == atoms2;
+  }
+
+  /**
+   * @brief Returns the existing node with the same atoms as key, or a new copy of key after storing it.
+   */
+  static Node* intern(const Node &key){
+    std::pair<std::unordered_multimap<uint64_t, Node*>::iterator, std::unordered_multimap<uint64_t, Node*>::iterator> range = table().equal_range(key.hash);
+    for (std::unordered_multimap<uint64_t, Node*>::iterator it = range.first; it != range.second; ++it)
+      if (it->second->length == key.length && sameAtoms(it->second, &key))
+        return it->second;
+    Node* node = new Node(key);
+    node->refs = 0;
+    node->str = NULL;
+    acquire(node->left);
+    acquire(node->right);
+    table().insert(std::pair<uint64_t, Node*>(node->hash, node));
+    return node;
+  }
+
+  static Node* leaf(uint32_t atom){
+    Node key;
+    // Mixes the atom so close ids don't give close hashes
+    uint64_t hash = (atom + 1) * 0x9e3779b97f4a7c15ULL;
+    key.hash = hash ^ (hash >> 29);
+    key.power = hash_base;
+    key.length = 1;
+    key.atom = atom;
+    key.left = key.right = NULL;
+    return intern(key);
+  }
+
+  static Node* concat(Node* left, Node* right){
+    if (left == NULL) return right;
+    if (right == NULL) return left;
+    Node key;
+    key.hash = left->hash * right->power + right->hash;
+    key.power = left->power * right->power;
+    key.length = left->length + right->length;
+    key.atom = 0;
+    key.left = left;
+    key.right = right;
+    return intern(key);
+  }
+
+  /**
+   * @brief Takes the ownership of a node, which may be shared.
+   */
+  explicit RegexDag(Node* node){
+    m_node = node;
+    acquire(m_node);
+  }
+
+  static const RegexDag& symbol(char c){
+    static const RegexDag open("("), close(")"), alternative("|"), star("*"), plus("+");
+    switch (c){
+      case '(': return open;
+      case ')': return close;
+      case '|': return alternative;
+      case '*': return star;
+      default: return plus;
+    }
+  }
+
+public:
+
+  /**
+   * @brief Builds an empty expression.
+   */
+  RegexDag(){
+    m_node = NULL;
+  }
+
+  RegexDag(const RegexDag &regex){
+    m_node = regex.m_node;
+    acquire(m_node);
+  }
+
+  RegexDag(RegexDag &&regex) noexcept{
+    m_node = regex.m_node;
+    regex.m_node = NULL;
+  }
+
+  RegexDag& operator=(const RegexDag &regex){
+    acquire(regex.m_node);
+    release(m_node);
+    m_node = regex.m_node;
+    return *this;
+  }
+
+  RegexDag& operator=(RegexDag &&regex) noexcept{
+    if (this != &regex){
+      release(m_node);
+      m_node = regex.m_node;
+      regex.m_node = NULL;
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Builds the expression that concatenate all the atomics exresion.
+   * @param strings Atomic expressions which composes the whole expression in its string representation.
+   * @param n Length of the strings vector.
+   */
+  RegexDag(const std::string* strings, int n){
+    RegexDag regex;
+    for (int i=0; i < n; i++)
+      regex = regex + RegexDag(strings[i]);
+    m_node = regex.m_node;
+    acquire(m_node);
+  }
+
+  /**
+   * @brief Builds a expression composed only by one atomic expression.
+   * @param str Atomic expression in its string representation.
+   */
+  RegexDag(const std::string &str){
+    m_node = leaf(AtomicRegex(str).id());
+    acquire(m_node);
+  }
+
+  ~RegexDag(){
+    release(m_node);
+  }
+
+  /**
+   * @brief Two expressions are equal if they have the same atoms, which means they share their node.
+   */
+  bool operator==(const RegexDag &regex) const{
+    return m_node == regex.m_node;
+  }
+
+  /**
+   * @brief Returns the expression composed by the n first atoms of the original one.
+   */
+  RegexDag head(int n) const{
+    if (n <= 0 || m_node == NULL)
+      return RegexDag();
+    if (n >= m_node->length)
+      return *this;
+    if (n <= m_node->left->length)
+      return RegexDag(m_node->left).head(n);
+    return RegexDag(m_node->left) + RegexDag(m_node->right).head(n - m_node->left->length);
+  }
+
+  /**
+   * @brief Returns the expression composed by the n last atoms of the original one.
+   */
+  RegexDag tail(int n) const{
+    if (n <= 0 || m_node == NULL)
+      return RegexDag();
+    if (n >= m_node->length)
+      return *this;
+    if (n <= m_node->right->length)
+      return RegexDag(m_node->right).tail(n);
+    return RegexDag(m_node->left).tail(n - m_node->right->length) + RegexDag(m_node->right);
+  }
+
+  /**
+   * @brief Returns the number of atoms which compose the expression.
+   */
+  int length() const{
+    return m_node == NULL ? 0 : m_node->length;
+  }
+
+  /**
+   * @brief Returns the hash of the atoms of the expression.
+   */
+  uint64_t hash() const{
+    return m_node == NULL ? 0 : m_node->hash;
+  }
+
+  RegexDag operator+(const RegexDag& regex) const{
+    return RegexDag(concat(m_node, regex.m_node));
+  }
+
+  /**
+   * @brief Returns the expression resulting from add the | (or) operator between two expressions.
+   */
+  RegexDag operator|(const RegexDag& regex) const{
+    return symbol('(') + *this + symbol('|') + regex + symbol(')');
+  }
+
+  /**
+   * @brief Returns the expression resulting from the concatenation operation between two regular expressions.
+   */
+  RegexDag operator*(const RegexDag& regex) const{
+    return symbol('(') + (*this + regex) + symbol(')');
+  }
+
+  /**
+   * @brief Returns the expression with the * operator (clausure).
+   */
+  RegexDag operator*() const{
+    return symbol('(') + *this + symbol(')') + symbol('*');
+  }
+
+  /**
+   * @brief Returns the expression with the + operator (clausure without empty word).
+   */
+  RegexDag operator++(int n) const{
+    return symbol('(') + *this + symbol(')') + symbol('+');
+  }
+
+  /**
+   * @brief Returns the string representation, which is kept in the node after the first call.
+   */
+  const std::string& toString() const{
+    static const std::string empty;
+    if (m_node == NULL)
+      return empty;
+    if (m_node->str == NULL){
+      std::vector<uint32_t> ids;
+      atoms(m_node, ids);
+      m_node->str = new std::string;
+      for (size_t i=0; i < ids.size(); i++)
+        *m_node->str += AtomTable::global().string(ids[i]);
+    }
+    return *m_node->str;
+  }
+
+  /**
+   * @brief Returns the number of different nodes of all the expressions.
+   */
+  static size_t nodes(){
+    return table().size();
+  }
+
+  friend std::ostream& operator<<(std::ostream& os, const RegexDag& regex);
+};
+
+std::ostream& operator<<(std::ostream& os, const RegexDag& regex){
+  os << regex.toString();
+  return os;
+}
+#endif
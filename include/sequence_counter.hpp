@@ -0,0 +1,326 @@
+/**
+ * @file sequence_counter.hpp
+ * @brief Counting of the expressions which are a short sequence of characters or character classes, without
+ * automata
+ */
+
+#ifndef _SEQUENCE_COUNTER_H_
+#define _SEQUENCE_COUNTER_H_
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+#include "automaton.hpp"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SEQUENCE_SIMD
+#include <immintrin.h>
+#endif
+
+
+
+/**
+ * @brief Counts the matches of the expressions which are a sequence of up to max_length characters or character
+ * classes ("[a-z]", ":", "\n", "[0-9]\".\""...), which are most of the basic expressions of the training. Every
+ * position where the sequence starts is a match, so the automaton isn't needed: the expressions of a single class
+ * add the histogram of the bytes of its members, and the longer ones the positions where the bitmaps of their
+ * classes, shifted by their position in the sequence, are all set. The bitmaps are built by AVX2 or SSE4.1 kernels,
+ * 32 or 16 bytes at once, when the processor has them. The matches are the same that MatchCounter counts.
+ */
+class SequenceCounter{
+public:
+  static const int max_length = 4;
+  // Bytes whose bitmaps are built at once, few enough for the bitmaps of every class to stay in the L1 or L2 cache
+  static const int block_size = 4096;
+
+private:
+  struct Class{
+    CharSet set;
+    unsigned char member[256]; // Whether each byte belongs to the class
+    unsigned char nibbles[32]; // Bit h of nibbles[n] (nibbles[16+n]) tells whether the byte with high nibble
+                               // h (8+h) and low nibble n belongs to the class
+  };
+
+  typedef void (*BitmapKernel)(const Class &cls, const unsigned char* data, size_t length, uint64_t* bits);
+  typedef uint64_t (*CountKernel)(const uint64_t* const* bitmaps, int length, size_t first, size_t last);
+
+  std::vector<Class> m_classes;
+  std::vector<std::vector<int> > m_sequences; // Classes of each expression
+  std::vector<bool> m_mapped;                 // Whether a class is in an expression of several classes
+  std::vector<std::vector<uint64_t> > m_bitmaps;
+  std::vector<uint64_t> m_counts;
+  std::vector<unsigned char> m_window;        // Last bytes of the previous data, followed by the data
+  int m_carry_size;
+
+  // Sets the bit i of bits if data[i] belongs to the class, for the bytes after the first done
+  static void bitmapScalar(const Class &cls, const unsigned char* data, size_t length, uint64_t* bits, size_t done){
+    for (size_t i=done; i < length; i++)
+      bits[i/64] |= (uint64_t)cls.member[data[i]] << (i%64);
+  }
+
+  static void bitmapScalar(const Class &cls, const unsigned char* data, size_t length, uint64_t* bits){
+    bitmapScalar(cls, data, length, bits, 0);
+  }
+
+  // Positions in [first, last] where every bitmap is set, each one shifted by its position in the sequence
+  template <int length>
+  __attribute__((always_inline)) static inline uint64_t countWords(const uint64_t* const* bitmaps, size_t first, size_t last){
+    uint64_t count = 0;
+    size_t first_word = first/64, last_word = last/64;
+    for (size_t w=first_word; w <= last_word; w++){
+      uint64_t bits = bitmaps[0][w];
+      for (int j=1; j < length; j++)
+        bits &= (bitmaps[j][w] >> j) | (bitmaps[j][w+1] << (64-j));
+      if (w == first_word)
+        bits &= ~(uint64_t)0 << (first%64);
+      if (w == last_word)
+        bits &= ~(uint64_t)0 >> (63 - last%64);
+      count += __builtin_popcountll(bits);
+    }
+    return count;
+  }
+
+  __attribute__((always_inline)) static inline uint64_t countWords(const uint64_t* const* bitmaps, int length, size_t first, size_t last){
+    switch (length){
+      case 2: return countWords<2>(bitmaps, first, last);
+      case 3: return countWords<3>(bitmaps, first, last);
+      default: return countWords<max_length>(bitmaps, first, last);
+    }
+  }
+
+  static uint64_t countScalar(const uint64_t* const* bitmaps, int length, size_t first, size_t last){
+    return countWords(bitmaps, length, first, last);
+  }
+
+#ifdef SEQUENCE_SIMD
+  // Bytes of v which belong to the class, as 0xff: the low nibble chooses a row of the nibble tables, the
+  // high bit of the byte which half of the row and the high nibble the bit
+  __attribute__((target("avx2"))) static inline __m256i memberAvx2(__m256i v, __m256i low, __m256i high){
+    const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+                                          1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    __m256i low_nibbles = _mm256_and_si256(v, _mm256_set1_epi8(0x0f));
+    __m256i high_nibbles = _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0f));
+    __m256i row = _mm256_blendv_epi8(_mm256_shuffle_epi8(low, low_nibbles), _mm256_shuffle_epi8(high, low_nibbles), v);
+    __m256i bit = _mm256_shuffle_epi8(bits, high_nibbles);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit);
+  }
+
+  __attribute__((target("avx2"))) static void bitmapAvx2(const Class &cls, const unsigned char* data, size_t length, uint64_t* bits){
+    __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)cls.nibbles));
+    __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(cls.nibbles + 16)));
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64){
+      uint32_t first = _mm256_movemask_epi8(memberAvx2(_mm256_loadu_si256((const __m256i*)(data + i)), low, high));
+      uint32_t second = _mm256_movemask_epi8(memberAvx2(_mm256_loadu_si256((const __m256i*)(data + i + 32)), low, high));
+      bits[i/64] = first | (uint64_t)second << 32;
+    }
+    bitmapScalar(cls, data, length, bits, i);
+  }
+
+  __attribute__((target("sse4.1"))) static inline __m128i memberSse4(__m128i v, __m128i low, __m128i high){
+    const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    __m128i low_nibbles = _mm_and_si128(v, _mm_set1_epi8(0x0f));
+    __m128i high_nibbles = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f));
+    __m128i row = _mm_blendv_epi8(_mm_shuffle_epi8(low, low_nibbles), _mm_shuffle_epi8(high, low_nibbles), v);
+    __m128i bit = _mm_shuffle_epi8(bits, high_nibbles);
+    return _mm_cmpeq_epi8(_mm_and_si128(row, bit), bit);
+  }
+
+  __attribute__((target("sse4.1"))) static void bitmapSse4(const Class &cls, const unsigned char* data, size_t length, uint64_t* bits){
+    __m128i low = _mm_loadu_si128((const __m128i*)cls.nibbles);
+    __m128i high = _mm_loadu_si128((const __m128i*)(cls.nibbles + 16));
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64){
+      uint64_t word = 0;
+      for (int j=0; j < 4; j++)
+        word |= (uint64_t)(uint16_t)_mm_movemask_epi8(memberSse4(_mm_loadu_si128((const __m128i*)(data + i + 16*j)), low, high)) << (16*j);
+      bits[i/64] = word;
+    }
+    bitmapScalar(cls, data, length, bits, i);
+  }
+
+  __attribute__((target("popcnt"))) static uint64_t countPopcnt(const uint64_t* const* bitmaps, int length, size_t first, size_t last){
+    return countWords(bitmaps, length, first, last);
+  }
+#endif
+
+  // Kernels of the best instructions of the processor, chosen the first time
+  static BitmapKernel bitmapKernel(){
+#ifdef SEQUENCE_SIMD
+    static const BitmapKernel chosen = __builtin_cpu_supports("avx2") ? bitmapAvx2 :
+                                       __builtin_cpu_supports("sse4.1") ? bitmapSse4 : (BitmapKernel)bitmapScalar;
+    return chosen;
+#else
+    return bitmapScalar;
+#endif
+  }
+
+  static CountKernel countKernel(){
+#ifdef SEQUENCE_SIMD
+    static const CountKernel chosen = __builtin_cpu_supports("popcnt") ? countPopcnt : countScalar;
+    return chosen;
+#else
+    return countScalar;
+#endif
+  }
+
+  int addClass(const CharSet &set){
+    for (int i=0; i < m_classes.size(); i++)
+      if (m_classes[i].set == set)
+        return i;
+    Class cls;
+    cls.set = set;
+    memset(cls.nibbles, 0, sizeof(cls.nibbles));
+    for (int c=0; c < 256; c++){
+      cls.member[c] = set.test(c);
+      if (set.test(c))
+        cls.nibbles[(c >> 7)*16 + (c & 0x0f)] |= 1 << ((c >> 4) & 7);
+    }
+    m_classes.push_back(cls);
+    m_mapped.push_back(false);
+    m_bitmaps.push_back(std::vector<uint64_t>());
+    return m_classes.size()-1;
+  }
+
+  // Counts the matches of the expressions of several classes which end in data
+  void feedBlock(const unsigned char* data, size_t length){
+    // The window starts with the last bytes of the previous data, so matches which start there are counted too
+    size_t window_size = m_carry_size + length;
+    m_window.resize(window_size);
+    memcpy(&m_window[m_carry_size], data, length);
+    BitmapKernel bitmap = bitmapKernel();
+    for (int c=0; c < m_classes.size(); c++)
+      if (m_mapped[c]){
+        m_bitmaps[c].assign(window_size/64 + 2, 0);
+        bitmap(m_classes[c], &m_window[0], window_size, &m_bitmaps[c][0]);
+      }
+
+    CountKernel count = countKernel();
+    for (int r=0; r < m_sequences.size(); r++){
+      const std::vector<int> &classes = m_sequences[r];
+      int sequence_length = classes.size();
+      if (sequence_length == 1 || window_size < (size_t)sequence_length)
+        continue;
+      const uint64_t* bitmaps[max_length];
+      for (int j=0; j < sequence_length; j++)
+        bitmaps[j] = &m_bitmaps[classes[j]][0];
+      size_t first = std::max(0, m_carry_size - sequence_length + 1);
+      size_t last = window_size - sequence_length;
+      if (first <= last)
+        m_counts[r] += count(bitmaps, sequence_length, first, last);
+    }
+
+    int kept = std::min((int)window_size, max_length-1);
+    memmove(&m_window[0], &m_window[window_size - kept], kept);
+    m_carry_size = kept;
+  }
+
+public:
+
+  SequenceCounter(){
+    m_carry_size = 0;
+  }
+
+  /**
+   * @brief Obtains the classes of an expression which is a sequence of characters or character classes.
+   * @param regex Expression in lex syntax.
+   * @param sets Class of each position of the sequence.
+   * @return false if the expression isn't a sequence of 1 to max_length classes.
+   */
+  static bool parse(const std::string &regex, std::vector<CharSet> &sets){
+    Nfa nfa;
+    sets.clear();
+    if (!nfa.addRegex(regex))
+      return false;
+    const std::vector<Nfa::State> &states = nfa.states();
+    int s = nfa.starts()[0];
+    for (size_t steps=0; s >= 0 && steps <= states.size(); steps++){
+      const Nfa::State &state = states[s];
+      if (state.match >= 0)
+        return state.out1 < 0 && !sets.empty();
+      if (state.out2 >= 0)
+        return false;
+      if (state.set >= 0){
+        if (sets.size() == max_length)
+          return false;
+        sets.push_back(nfa.sets()[state.set]);
+      }
+      s = state.out1;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Adds an expression to count. Its matches will be reported with the index of the expression (the
+   * number of expressions added before it).
+   * @return false if it isn't a sequence which the counter can count. In that case it isn't added.
+   */
+  bool add(const std::string &regex){
+    std::vector<CharSet> sets;
+    if (!parse(regex, sets))
+      return false;
+    std::vector<int> classes;
+    for (int j=0; j < sets.size(); j++){
+      classes.push_back(addClass(sets[j]));
+      if (sets.size() > 1)
+        m_mapped[classes.back()] = true;
+    }
+    m_sequences.push_back(classes);
+    m_counts.push_back(0);
+    return true;
+  }
+
+  /**
+   * @brief Returns the number of expressions added.
+   */
+  int size() const{
+    return m_sequences.size();
+  }
+
+  /**
+   * @brief Prepares the counter to count the matches of a new input.
+   */
+  void reset(){
+    m_counts.assign(m_sequences.size(), 0);
+    m_carry_size = 0;
+  }
+
+  /**
+   * @brief Counts the matches which end in data. Matches which start in a previous call are also counted.
+   */
+  void feed(const char* data, size_t length){
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t histogram[4][256] = {{0}};
+    size_t i = 0;
+    // Four histograms, so consecutive equal bytes don't wait for each other
+    for (; i + 4 <= length; i += 4){
+      histogram[0][bytes[i]]++;
+      histogram[1][bytes[i+1]]++;
+      histogram[2][bytes[i+2]]++;
+      histogram[3][bytes[i+3]]++;
+    }
+    for (; i < length; i++)
+      histogram[0][bytes[i]]++;
+    for (int c=0; c < 256; c++)
+      histogram[0][c] += histogram[1][c] + histogram[2][c] + histogram[3][c];
+    for (int r=0; r < m_sequences.size(); r++)
+      if (m_sequences[r].size() == 1){
+        const unsigned char* member = m_classes[m_sequences[r][0]].member;
+        for (int c=0; c < 256; c++)
+          m_counts[r] += member[c] ? histogram[0][c] : 0;
+      }
+
+    for (size_t block=0; block < length; block += block_size)
+      feedBlock(bytes + block, std::min(length - block, (size_t)block_size));
+  }
+
+  /**
+   * @brief Returns the number of matches of each expression counted since the last reset.
+   */
+  const std::vector<uint64_t>& counts() const{
+    return m_counts;
+  }
+};
+
+#endif
@@ -0,0 +1,217 @@
+/**
+ * @file trace.hpp
+ * @brief Timing of the phases of the training and statistics of every generation
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+
+
+
+/**
+ * @brief Records the wall time of the training phases and the statistics of each generation. Every
+ * generation is written as a JSON line, and every phase as a complete event of the Chrome trace format
+ * (chrome://tracing or Perfetto). While no file is open, the phases aren't timed, so a disabled trace
+ * only costs a branch per phase. Phases can be recorded from several threads, each one in its own row of the
+ * Chrome trace, and their times are added to the same generation.
+ */
+class Trace{
+private:
+  FILE* m_jsonl;
+  FILE* m_chrome;
+  bool m_first_event;
+  std::chrono::steady_clock::time_point m_start;
+  std::map<std::string, double> m_phase_ms;
+  uint64_t m_bytes_scanned, m_regexs_evaluated, m_cache_hits, m_cache_lookups;
+  std::mutex m_mutex;
+
+  // Row of the calling thread in the Chrome trace, numbered from 1 in the order they record their first phase
+  int threadRow(){
+    static int rows = 0;
+    static thread_local int row = 0;
+    if (row == 0)
+      row = ++rows;
+    return row;
+  }
+
+  void clearGeneration(){
+    m_phase_ms.clear();
+    m_bytes_scanned = m_regexs_evaluated = m_cache_hits = m_cache_lookups = 0;
+  }
+
+  static std::string jsonString(const std::string &str){
+    std::string json = "\"";
+    for (size_t i=0; i < str.size(); i++){
+      if (str[i] == '"' || str[i] == '\\')
+        json += '\\';
+      json += str[i];
+    }
+    return json + "\"";
+  }
+
+public:
+
+  Trace(){
+    m_jsonl = NULL;
+    m_chrome = NULL;
+    m_first_event = true;
+    m_start = std::chrono::steady_clock::now();
+    resetGeneration();
+  }
+
+  ~Trace(){
+    close();
+  }
+
+  /**
+   * @brief Starts writing the trace.
+   * @param jsonl_path File of the generations, one JSON object per line. Empty to not write it.
+   * @param chrome_path File of the phases in the Chrome trace format. Empty to not write it.
+   * @return false if a file can't be created.
+   */
+  bool open(const std::string &jsonl_path, const std::string &chrome_path){
+    close();
+    if (!jsonl_path.empty() && (m_jsonl = fopen(jsonl_path.c_str(), "w")) == NULL)
+      return false;
+    if (!chrome_path.empty()){
+      if ((m_chrome = fopen(chrome_path.c_str(), "w")) == NULL)
+        return false;
+      fputs("{\"traceEvents\":[\n", m_chrome);
+      m_first_event = true;
+    }
+    m_start = std::chrono::steady_clock::now();
+    resetGeneration();
+    return true;
+  }
+
+  /**
+   * @brief Finishes the files of the trace.
+   */
+  void close(){
+    if (m_jsonl != NULL)
+      fclose(m_jsonl);
+    if (m_chrome != NULL){
+      fputs("\n]}\n", m_chrome);
+      fclose(m_chrome);
+    }
+    m_jsonl = NULL;
+    m_chrome = NULL;
+  }
+
+  bool enabled() const{
+    return m_jsonl != NULL || m_chrome != NULL;
+  }
+
+  /**
+   * @brief Microseconds since the trace was opened.
+   */
+  double now() const{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - m_start).count();
+  }
+
+  /**
+   * @brief Records a phase of the current generation.
+   * @param name Name of the phase.
+   * @param start Start of the phase, as returned by now().
+   * @param end End of the phase, as returned by now().
+   */
+  void phase(const char* name, double start, double end){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_phase_ms[name] += (end - start) / 1000;
+    if (m_chrome != NULL){
+      fprintf(m_chrome, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}", m_first_event ? "" : ",\n", name, start, end - start, threadRow());
+      m_first_event = false;
+    }
+  }
+
+  /**
+   * @brief Adds the bytes read by the scanners and the expressions they counted.
+   */
+  void scanned(uint64_t bytes, uint64_t regexs){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_bytes_scanned += bytes;
+    m_regexs_evaluated += regexs;
+  }
+
+  /**
+   * @brief Adds the lookups of the counts cache and how many of them were found.
+   */
+  void cacheLookups(uint64_t lookups, uint64_t hits){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cache_lookups += lookups;
+    m_cache_hits += hits;
+  }
+
+  /**
+   * @brief Writes the statistics of a finished generation and starts the next one.
+   * @param format Format whose expressions are trained.
+   * @param generation Number of the generation inside the training of the format.
+   * @param goodness Goodness of the selected expressions.
+   */
+  void generation(const std::string &format, int generation, std::vector<double> goodness){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_jsonl != NULL){
+      double best = 0, median = 0;
+      if (!goodness.empty()){
+        std::sort(goodness.begin(), goodness.end());
+        best = goodness.back();
+        median = goodness[goodness.size() / 2];
+      }
+      fprintf(m_jsonl, "{\"format\":%s,\"generation\":%d,\"ts_ms\":%.3f,\"phases_ms\":{", jsonString(format).c_str(), generation, now() / 1000);
+      for (std::map<std::string, double>::iterator it = m_phase_ms.begin(); it != m_phase_ms.end(); ++it)
+        fprintf(m_jsonl, "%s%s:%.3f", it == m_phase_ms.begin() ? "" : ",", jsonString(it->first).c_str(), it->second);
+      fprintf(m_jsonl, "},\"bytes_scanned\":%llu,\"regexs_evaluated\":%llu,\"cache_lookups\":%llu,\"cache_hits\":%llu,\"cache_hit_rate\":%.4f,\"best_goodness\":%g,\"median_goodness\":%g}\n",
+              (unsigned long long)m_bytes_scanned, (unsigned long long)m_regexs_evaluated, (unsigned long long)m_cache_lookups, (unsigned long long)m_cache_hits,
+              m_cache_lookups > 0 ? (double)m_cache_hits / m_cache_lookups : 0.0, best, median);
+      fflush(m_jsonl);
+    }
+    clearGeneration();
+  }
+
+  void resetGeneration(){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    clearGeneration();
+  }
+};
+
+
+/**
+ * @brief Trace of the training. Disabled until it's opened.
+ */
+Trace trace;
+
+
+/**
+ * @brief Records the lifetime of the object as a phase of the trace.
+ */
+class TraceScope{
+private:
+  const char* m_name;
+  double m_start;
+
+public:
+
+  /**
+   * @param name Name of the phase. It must outlive the object.
+   */
+  TraceScope(const char* name){
+    m_name = name;
+    m_start = trace.enabled() ? trace.now() : 0;
+  }
+
+  ~TraceScope(){
+    if (trace.enabled())
+      trace.phase(m_name, m_start, trace.now());
+  }
+};
+
+#endif
@@ -0,0 +1,1445 @@
+/**
+ * @file training.hpp
+ * @brief Genetic algorithm which trains the expressions of each format
+ */
+
+#ifndef _TRAINING_H_
+#define _TRAINING_H_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <utility>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <future>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <boost/filesystem.hpp>
+#include "regex.hpp"
+#include "regex_dag.hpp"
+#include "file_templates.hpp"
+#include "automaton.hpp"
+#include "sequence_counter.hpp"
+#include "trace.hpp"
+#include "word_index.hpp"
+#include "ngram_stats.hpp"
+#include "prestage.hpp"
+#include "transport.hpp"
+using namespace std;
+namespace fs = boost::filesystem;
+#define likely(x)       __builtin_expect((x),1)
+#define unlikely(x)     __builtin_expect((x),0)
+
+// Representation of the expressions of the pool. With REGEX_DAG they share their common parts
+#ifdef REGEX_DAG
+typedef RegexDag PoolRegex;
+#else
+typedef Regex PoolRegex;
+#endif
+
+
+string basic_pool[] = { "[a-z]", "[A-Z]", "[0-9]", "\\?" "\t", ".", "\\{", "\\}",
+                        "\\n", ":", "\\<", "\\>", "#", "%", "~", "@", "=", "\\*",
+                        "\\+", "\\-", "0", "1", "2", "3", "4", "5", "6", "7", "8", "9",
+                        "a", "A", "b", "B", "c", "C", "d", "D", "e", "E", "f", "F", "g",
+                        "G", "h", "H", "i", "I", "j", "J", "k", "K", "l", "L", "m", "M",
+                        "n", "N", "o", "O", "p", "P", "q", "Q", "r", "R", "s", "S", "t",
+                        "T", "u", "U", "v", "V", "w", "W", "x", "X", "y", "Y", "z", "Z"};
+
+// basic_pool interned in the AtomTable, so filling the pool doesn't look up the strings again
+const int basic_size = sizeof(basic_pool)/sizeof(string);
+const vector<PoolRegex> basic_regexs(basic_pool, basic_pool + basic_size);
+
+// Backend used to count the matches: "lex" compiles count.lex, "dfa" counts in process with automaton.hpp and
+// "lazy" does too, building only the states of the automaton which the files reach
+string count_backend = "lex";
+// Whether the expressions which are a short sequence of characters or classes are counted by SequenceCounter
+// instead of the backend
+bool count_sequences = true;
+// Maximum number of states of each automaton of the dfa backend
+const int count_max_states = 1 << 12;
+// Maximum number of states cached by the automaton of the lazy backend
+int count_lazy_states = 1 << 14;
+// Files scanned at once, a byte of each in turn, by each automaton of the dfa backend (at most
+// MatchCounter::max_streams). It's an experiment which has measured slower than 1, the default
+int count_streams = 1;
+// Addresses of the count_worker processes among which the files are split to count the matches
+// ("unix:<path>" or "<host>:<port>"). If it's empty the matches are counted in process
+vector<string> count_workers;
+// Directory to which the paths of the files sent to the workers are relative
+fs::path count_root;
+// Whether the initial pool is seeded with the n-grams which tell the formats apart, or only with basic_pool
+bool seed_pool = true;
+// Whether the offspring of the next generation are bred and counted while the current one is selected
+bool pipelined_generations = false;
+// Offspring bred and counted in each step of the steady-state training, which replace the worst expressions of
+// the pool one by one instead of selecting whole generations (0 trains by generations)
+int steady_batch = 0;
+// Whether count_matches reuses the counts of the expressions already counted in the same files
+bool count_cache = true;
+// Counts of each expression, by set of files. It's emptied when it reaches count_cache_limit expressions
+map<string, unordered_map<string, uint64_t> > count_cache_entries;
+size_t count_cache_size = 0;
+const size_t count_cache_limit = 1 << 20;
+// Bytes of each set of files, by the key of count_cache_entries. With workers they're the totals of their shards,
+// so the training doesn't read the files of the rest of formats
+map<string, uint64_t> files_bytes_entries;
+// With workers, the seeding ranks this many candidates per seed, the most frequent in the files of the format,
+// with the matches which the workers count in the rest
+const int seed_candidates_factor = 8;
+// Weight of the scan cost of an expression against its goodness in the selection (0 ignores the cost)
+double cost_weight = 0;
+// Whether the selection keeps the expressions of the best Pareto fronts of goodness and scan cost
+bool pareto_selection = false;
+// MB/s which the automaton of the final expressions of each format must reach (0 disables the target)
+double target_throughput = 0;
+// Bytes of the training files over which the scan cost of each expression is measured
+const size_t cost_sample_size = 1 << 16;
+// Scan cost of each expression over scan_cost_sample
+string scan_cost_sample;
+unordered_map<string, double> scan_cost_entries;
+
+
+/**
+ * @brief Performs the Crossover between regular expressions. It consist in an
+ * operation chossed randomly.
+ * @param regex1 First expression for the Crossover.
+ * @param regex2 Second expression for the Crossover.
+ */
+PoolRegex crossover(const PoolRegex &regex1, const PoolRegex &regex2){
+  int operation = (int)rand() % 4;
+  switch (operation) {
+    case 0: return regex1 * regex2; break; // e1e2
+    case 1: return regex1 | regex2; break; // e1 + e2
+    case 2: return regex1++; break; // e1+
+    case 3: return *regex1; break; // e1*
+  }
+}
+
+
+/**
+ * @brief Performs a muttation in a regular expression and adds it at the pool,
+ * @param regex Base regex for the muttation.
+ * @param pool Pool in which the muttation will be added.
+ */
+PoolRegex mutation(const PoolRegex &regex, const vector<PoolRegex> &pool){
+  PoolRegex rand_word = pool[rand() % pool.size()];
+  int split_point = (int)(rand()%(regex.length()));
+  return regex.head(split_point) + rand_word + regex.tail(regex.length()-split_point);
+}
+
+
+/**
+ * @brief Adds n randomly chossed words in the pool. Every word of the files has the same probability.
+ * @param pool Pool in which the words will be added.
+ * @param words Index of the words of the files from which the words are taken.
+ * @param n Number of words to insert.
+ */
+void insertWordsFromFiles(vector<PoolRegex> &pool, const WordIndex &words, int n){
+  string word, str;
+  for (int i=0; i < n; i++){
+    // rand() may give only 31 bits, which aren't enough for big corpora
+    size_t index = words.size() == 0 ? 0 : (((size_t)rand() << 31) ^ rand()) % words.size();
+    word = words.size() == 0 ? "" : words.word(index);
+    // Quoted to take the expression literally
+    str = "\"";
+    for (size_t j=0; j < word.size(); j++){
+      if (word[j] == '\"')
+        str += "\\";
+      str.push_back(word[j]);
+    }
+    str += "\"";
+    pool.push_back(PoolRegex(str));
+  }
+}
+
+
+/**
+ * @brief Builds the initial pool. It is only some basic_pool elements in a std::vector form.
+ * @param pool Vector to store the pool.
+ * @param p Pool size.
+ */
+void buildInitialPool(vector<PoolRegex> &pool, int p){
+  cerr << "Building initial pool" << endl;
+  for (int i=0; i < p; i++){
+    pool.push_back(basic_regexs[rand() % basic_size]);
+  }
+}
+
+
+/**
+ * @bief Performs the genetic operations (Crossover and Mutation).
+ * @param pool Pool to add the genetic operations results.
+ * @param n Number of genetic operations to do.
+ * @param epsilon Probability of the muttation. Must be a value between 0 and 1.
+ */
+void genetic_operations(vector<PoolRegex> &pool, int n, double epsilon){
+  int r;
+  for (int i=0; i < n; i++){
+    r = rand() % 100;
+    if (unlikely(r < epsilon*100)){
+      pool.push_back(mutation(pool[rand() % pool.size()], pool));
+    } else {
+      pool.push_back(crossover(pool[rand() % pool.size()], pool[rand() % pool.size()]));
+    }
+  }
+}
+
+
+/**
+ * @brief Builds the automata which count the expressions in [first, last). The expressions are split
+ * in halves until each automaton has at most count_max_states states.
+ * @param regexs Expressions to count.
+ * @param dfas Automata built.
+ * @param dfa_regexs First expression of each automaton.
+ */
+void build_count_dfas(const vector<string> &regexs, int first, int last, vector<Dfa> &dfas, vector<int> &dfa_regexs){
+  Nfa nfa;
+  for (int i=first; i < last; i++)
+    nfa.addRegex(regexs[i]);
+  dfas.push_back(Dfa());
+  dfa_regexs.push_back(first);
+  if (dfas.back().build(nfa, count_max_states))
+    return;
+  dfas.pop_back();
+  dfa_regexs.pop_back();
+  if (last - first == 1){
+    // Like flex, an expression which can't be compiled doesn't match
+    dfas.push_back(Dfa());
+    dfa_regexs.push_back(first);
+    return;
+  }
+  build_count_dfas(regexs, first, (first+last)/2, dfas, dfa_regexs);
+  build_count_dfas(regexs, (first+last)/2, last, dfas, dfa_regexs);
+}
+
+
+/**
+ * @brief Counts the number of matches of the expressions in all the files without generating count.lex.
+ * The result is the same, but every file is read once and scanned in a single pass by each automaton. With
+ * count_streams above 1, each automaton scans that many files at once.
+ * @param regex Regular expresions whose matches will count.
+ * @param files_paths Paths of the files against which the regular expressions will be matched.
+ */
+vector<uint64_t> count_matches_dfa(const vector<string> &regexs, const vector<fs::path> &files_paths){
+  vector<Dfa> dfas;
+  vector<int> dfa_regexs;
+  vector<uint64_t> matches(regexs.size(), 0);
+  if (regexs.empty())
+    return matches;
+  {
+    TraceScope scope("dfa_build");
+    build_count_dfas(regexs, 0, regexs.size(), dfas, dfa_regexs);
+    dfa_regexs.push_back(regexs.size());
+  }
+
+  TraceScope scope("scan");
+  // A counter and a buffer per automaton and stream; the streams read count_streams files at the same time
+  int streams = max(1, min(count_streams, (int)MatchCounter::max_streams));
+  vector<vector<MatchCounter> > counters(streams, vector<MatchCounter>(dfas.size()));
+  vector<vector<char> > buffers(streams, vector<char>(1 << 16));
+  vector<ifstream> files(streams);
+  vector<MatchCounter*> stream_counters(streams);
+  vector<const char*> stream_data(streams);
+  vector<size_t> stream_lengths(streams);
+  uint64_t bytes = 0;
+  for (size_t first=0; first < files_paths.size(); first += streams){
+    int opened = min((size_t)streams, files_paths.size() - first);
+    for (int l=0; l < opened; l++){
+      files[l].close();
+      files[l].clear();
+      files[l].open(files_paths[first + l].string(), ifstream::binary);
+      for (int i=0; i < dfas.size(); i++)
+        counters[l][i].reset(dfas[i], dfa_regexs[i+1] - dfa_regexs[i]);
+    }
+    while (true){
+      int active = 0;
+      for (int l=0; l < opened; l++){
+        files[l].read(&buffers[l][0], buffers[l].size());
+        if (files[l].gcount() > 0){
+          stream_data[active] = &buffers[l][0];
+          stream_lengths[active] = files[l].gcount();
+          bytes += files[l].gcount();
+          active++;
+        }
+      }
+      if (active == 0)
+        break;
+      for (int i=0; i < dfas.size(); i++){
+        for (int l=0, a=0; l < opened; l++)
+          if (files[l].gcount() > 0)
+            stream_counters[a++] = &counters[l][i];
+        MatchCounter::feedStreams(&stream_counters[0], &stream_data[0], &stream_lengths[0], active);
+      }
+    }
+    for (int l=0; l < opened; l++)
+      for (int i=0; i < dfas.size(); i++)
+        for (int j=dfa_regexs[i]; j < dfa_regexs[i+1]; j++)
+          matches[j] += counters[l][i].counts()[j - dfa_regexs[i]];
+  }
+  trace.scanned(bytes, regexs.size());
+  return matches;
+}
+
+
+/**
+ * @brief Counts the number of matches of the expressions in all the files like count_matches_dfa, with a single
+ * automaton of all the expressions whose states are built while the files are scanned. Expressions whose
+ * automaton would explode only cost the states which the files reach, and at most count_lazy_states of them
+ * are kept: beyond that the automaton steps the Nfa.
+ * @param regex Regular expresions whose matches will count.
+ * @param files_paths Paths of the files against which the regular expressions will be matched.
+ */
+vector<uint64_t> count_matches_lazy(const vector<string> &regexs, const vector<fs::path> &files_paths){
+  vector<uint64_t> matches(regexs.size(), 0);
+  Nfa nfa;
+  if (regexs.empty())
+    return matches;
+  {
+    TraceScope scope("dfa_build");
+    // Like flex, an expression which can't be compiled doesn't match
+    for (int i=0; i < regexs.size(); i++)
+      nfa.addRegex(regexs[i]);
+  }
+
+  TraceScope scope("scan");
+  LazyCounter counter(nfa, count_lazy_states);
+  vector<char> buffer(1 << 16);
+  uint64_t bytes = 0;
+  for (vector<fs::path>::const_iterator it = files_paths.begin(); it != files_paths.end(); ++it){
+    ifstream file(it->string(), ifstream::binary);
+    counter.reset();
+    while (file.read(&buffer[0], buffer.size()) || file.gcount() > 0){
+      bytes += file.gcount();
+      counter.feed(&buffer[0], file.gcount());
+    }
+    for (int j=0; j < regexs.size(); j++)
+      matches[j] += counter.counts()[j];
+  }
+  trace.scanned(bytes, regexs.size());
+  return matches;
+}
+
+
+/**
+ * @brief Returns the worker which counts a file. The files are spread by the hash (FNV-1a) of their path,
+ * so every worker gets the same shard in every generation and keeps it in its page cache.
+ * @param relative_path Path of the file relative to count_root.
+ */
+int file_worker(const string &relative_path){
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i=0; i < relative_path.size(); i++)
+    hash = (hash ^ (unsigned char)relative_path[i]) * 0x100000001b3ULL;
+  return hash % count_workers.size();
+}
+
+
+/**
+ * @brief Sends a request to a worker and reads its answer. A broken connection (a restarted worker) is opened
+ * again once. The training can't go on without the counts of a shard, so it ends if the worker doesn't answer.
+ */
+string worker_request(vector<unique_ptr<LineChannel> > &channels, int worker, const string &request, bool send, bool receive){
+  string answer;
+  for (int attempt=0; attempt < 2; attempt++){
+    if (!channels[worker] || attempt > 0){
+      int fd = openSocket(count_workers[worker], false);
+      channels[worker].reset(fd < 0 ? NULL : new LineChannel(fd));
+      if (fd < 0)
+        break;
+      send = true;
+    }
+    if ((!send || channels[worker]->write(request)) && (!receive || channels[worker]->readLine(answer)))
+      return answer;
+  }
+  cerr << "The worker " << count_workers[worker] << " doesn't answer" << endl;
+  exit(-1);
+}
+
+
+/**
+ * @brief Returns the key of a set of files in count_cache_entries and files_bytes_entries.
+ */
+string files_key(const vector<fs::path> &files_paths){
+  string key;
+  for (vector<fs::path>::const_iterator it = files_paths.begin(); it != files_paths.end(); ++it)
+    key += it->string() + '\n';
+  return key;
+}
+
+
+/**
+ * @brief Counts the number of matches of the expressions in all the files with the count_worker processes.
+ * Each worker counts the expressions in its shard of the files, with its own backend and cache, and the
+ * counts of all the shards are added. The requests are sent to every worker before waiting for any answer,
+ * so the shards are counted at the same time. The workers also answer the bytes of their shards, whose total
+ * is kept in files_bytes_entries, so the files are never read here.
+ * @param regex Regular expresions whose matches will count.
+ * @param files_paths Paths of the files against which the regular expressions will be matched.
+ */
+vector<uint64_t> count_matches_workers(const vector<string> &regexs, const vector<fs::path> &files_paths){
+  static vector<unique_ptr<LineChannel> > channels;
+  vector<uint64_t> matches(regexs.size(), 0);
+  vector<string> requests(count_workers.size());
+  vector<int> shard_files(count_workers.size(), 0);
+  string root = count_root.string() + "/";
+  uint64_t bytes = 0;
+  channels.resize(count_workers.size());
+
+  for (vector<fs::path>::const_iterator it = files_paths.begin(); it != files_paths.end(); ++it){
+    string path = it->string();
+    if (path.compare(0, root.size(), root) == 0)
+      path = path.substr(root.size());
+    int worker = file_worker(path);
+    requests[worker] += path + "\n";
+    shard_files[worker]++;
+  }
+  string regexs_lines;
+  for (int i=0; i < regexs.size(); i++)
+    regexs_lines += regexs[i] + "\n";
+
+  TraceScope scope("scan");
+  for (int w=0; w < count_workers.size(); w++)
+    if (shard_files[w] > 0){
+      requests[w] = "COUNT " + to_string(regexs.size()) + " " + to_string(shard_files[w]) + "\n" + regexs_lines + requests[w];
+      worker_request(channels, w, requests[w], true, false);
+    }
+  for (int w=0; w < count_workers.size(); w++){
+    if (shard_files[w] == 0)
+      continue;
+    // The bytes of the shard and then the matches of each expression
+    string answer = worker_request(channels, w, requests[w], false, true);
+    const char* pos = answer.c_str();
+    for (int i=-1; i < (int)regexs.size(); i++){
+      char* end;
+      uint64_t count = strtoull(pos, &end, 10);
+      if (end == pos){
+        cerr << "The worker " << count_workers[w] << " answers " << answer << endl;
+        exit(-1);
+      }
+      if (i < 0)
+        bytes += count;
+      else
+        matches[i] += count;
+      pos = end;
+    }
+  }
+  string key = files_key(files_paths);
+  if (files_bytes_entries.find(key) == files_bytes_entries.end())
+    files_bytes_entries[key] = bytes;
+  trace.scanned(bytes, regexs.size());
+  return matches;
+}
+
+
+/**
+ * @brief Returns the bytes of a set of files. With workers they're asked to them, without counting any
+ * expression, the first time; otherwise the files are stat'ed.
+ */
+uint64_t files_bytes(const vector<fs::path> &files_paths){
+  string key = files_key(files_paths);
+  map<string, uint64_t>::iterator it = files_bytes_entries.find(key);
+  if (it != files_bytes_entries.end())
+    return it->second;
+  if (!count_workers.empty()){
+    count_matches_workers(vector<string>(), files_paths);
+    return files_bytes_entries[key];
+  }
+  uint64_t bytes = 0;
+  for (vector<fs::path>::const_iterator file = files_paths.begin(); file != files_paths.end(); ++file)
+    bytes += fs::file_size(*file);
+  files_bytes_entries[key] = bytes;
+  return bytes;
+}
+
+
+/**
+ * @brief Counts the number of matches of the expressions which SequenceCounter can count in all the files.
+ * @param counter Counter with the expressions.
+ * @param files_paths Paths of the files against which the regular expressions will be matched.
+ */
+vector<uint64_t> count_matches_sequences(SequenceCounter &counter, const vector<fs::path> &files_paths){
+  TraceScope scope("sequence_scan");
+  vector<uint64_t> matches(counter.size(), 0);
+  vector<char> buffer(1 << 16);
+  uint64_t bytes = 0;
+  for (vector<fs::path>::const_iterator it = files_paths.begin(); it != files_paths.end(); ++it){
+    ifstream file(it->string(), ifstream::binary);
+    counter.reset();
+    while (file.read(&buffer[0], buffer.size()) || file.gcount() > 0){
+      bytes += file.gcount();
+      counter.feed(&buffer[0], file.gcount());
+    }
+    for (int j=0; j < counter.size(); j++)
+      matches[j] += counter.counts()[j];
+  }
+  trace.scanned(bytes, counter.size());
+  return matches;
+}
+
+
+/**
+ * @brief Counts the number of matches of the expressions in all the files with the configured backend.
+ * @param regex Regular expresions whose matches will count.
+ * @param files_paths Paths of the files against which the regular expressions will be matched.
+ */
+vector<uint64_t> count_matches_backend(const vector<string> &regexs, const vector<fs::path> &files_paths){
+  if (count_backend == "dfa")
+    return count_matches_dfa(regexs, files_paths);
+  if (count_backend == "lazy")
+    return count_matches_lazy(regexs, files_paths);
+  CountLexTemplate countTemplate;
+  {
+    TraceScope scope("template");
+    for (vector<string>::const_iterator it = regexs.begin(); it != regexs.end(); ++it)
+      countTemplate.addRegex(*it);
+    countTemplate.save("count.lex");
+  }
+  system("echo "" > out.txt");
+  {
+    TraceScope scope("flex");
+    system("flex count.lex");
+  }
+  {
+    TraceScope scope("gcc");
+    system("gcc lex.yy.c -o count -lfl");
+  }
+  fs::directory_iterator end_it;
+  string command_str = "./count ";
+  uint64_t bytes = 0;
+  for (vector<fs::path>::const_iterator it = files_paths.begin(); it != files_paths.end(); ++it){
+    command_str += it->string();
+    command_str += " ";
+    bytes += fs::file_size(*it);
+  }
+  command_str += "> out.txt";
+  {
+    TraceScope scope("scan");
+    system(command_str.c_str());
+  }
+  trace.scanned(bytes, regexs.size());
+  ifstream ifs("out.txt");
+  vector<uint64_t> matches;
+  uint64_t num;
+  for (int i=0; i < regexs.size(); i++){
+    ifs >> num;
+    matches.push_back(num);
+  }
+  return matches;
+}
+
+
+/**
+ * @brief Counts the number of matches of the expressions in all the files, in the workers if there are. The
+ * single characters, classes and short sequences, which are most of the pool, are counted by SequenceCounter,
+ * and only the rest by the backend.
+ * @param regex Regular expresions whose matches will count.
+ * @param files_paths Paths of the files against which the regular expressions will be matched.
+ */
+vector<uint64_t> count_matches_uncached(const vector<string> &regexs, const vector<fs::path> &files_paths){
+  if (!count_workers.empty())
+    return count_matches_workers(regexs, files_paths);
+  if (!count_sequences)
+    return count_matches_backend(regexs, files_paths);
+
+  SequenceCounter sequences;
+  vector<int> sequence_regexs, backend_regexs;
+  vector<string> backend_strings;
+  for (int i=0; i < regexs.size(); i++)
+    if (sequences.add(regexs[i]))
+      sequence_regexs.push_back(i);
+    else {
+      backend_regexs.push_back(i);
+      backend_strings.push_back(regexs[i]);
+    }
+  if (sequence_regexs.empty())
+    return count_matches_backend(regexs, files_paths);
+
+  vector<uint64_t> matches(regexs.size(), 0);
+  vector<uint64_t> sequence_matches = count_matches_sequences(sequences, files_paths);
+  for (int i=0; i < sequence_regexs.size(); i++)
+    matches[sequence_regexs[i]] = sequence_matches[i];
+  if (!backend_strings.empty()){
+    vector<uint64_t> backend_matches = count_matches_backend(backend_strings, files_paths);
+    for (int i=0; i < backend_regexs.size(); i++)
+      matches[backend_regexs[i]] = backend_matches[i];
+  }
+  return matches;
+}
+
+
+/**
+ * @brief Counts the number of matches of the expressions in all the files. The counts of an expression
+ * don't depend on the rest of expressions, so only the expressions which weren't counted before in the
+ * same files are scanned. The survivors of each generation and the repeated expressions of the pool are
+ * taken from the cache. It only uses the strings of the expressions, so it can run while other thread
+ * creates expressions, as long as it's the only one which counts.
+ * @param regex Regular expresions whose matches will count.
+ * @param files_paths Paths of the files against which the regular expressions will be matched.
+ */
+vector<uint64_t> count_matches(const vector<string> &regexs, const vector<fs::path> &files_paths){
+  if (!count_cache)
+    return count_matches_uncached(regexs, files_paths);
+
+  if (count_cache_size >= count_cache_limit){
+    count_cache_entries.clear();
+    count_cache_size = 0;
+  }
+  unordered_map<string, uint64_t> &entries = count_cache_entries[files_key(files_paths)];
+
+  vector<string> missing;
+  set<string> missing_strings;
+  for (int i=0; i < regexs.size(); i++)
+    if (entries.find(regexs[i]) == entries.end() && missing_strings.insert(regexs[i]).second)
+      missing.push_back(regexs[i]);
+  trace.cacheLookups(regexs.size(), regexs.size() - missing.size());
+
+  if (!missing.empty()){
+    vector<uint64_t> missing_matches = count_matches_uncached(missing, files_paths);
+    for (int i=0; i < missing.size(); i++)
+      entries[missing[i]] = missing_matches[i];
+    count_cache_size += missing.size();
+  }
+
+  vector<uint64_t> matches(regexs.size());
+  for (int i=0; i < regexs.size(); i++)
+    matches[i] = entries[regexs[i]];
+  return matches;
+}
+
+
+/**
+ * @brief Returns the strings of the expressions of a pool.
+ */
+vector<string> regex_strings(const vector<PoolRegex> &regexs){
+  vector<string> strings(regexs.size());
+  for (int i=0; i < regexs.size(); i++)
+    strings[i] = regexs[i].toString();
+  return strings;
+}
+
+
+vector<uint64_t> count_matches(const vector<PoolRegex> &regexs, const vector<fs::path> &files_paths){
+  return count_matches(regex_strings(regexs), files_paths);
+}
+
+
+/**
+ * @brief Reads the first bytes of some files, up to size bytes in total.
+ */
+string read_sample(const vector<fs::path> &files_paths, size_t size){
+  string sample;
+  vector<char> buffer(1 << 16);
+  for (vector<fs::path>::const_iterator it = files_paths.begin(); it != files_paths.end() && sample.size() < size; ++it){
+    ifstream file(it->string(), ifstream::binary);
+    while (sample.size() < size && (file.read(&buffer[0], min(buffer.size(), size - sample.size())) || file.gcount() > 0))
+      sample.append(&buffer[0], file.gcount());
+  }
+  return sample;
+}
+
+
+/**
+ * @brief Returns the sample of the files of the current format and the rest over which the scan costs are measured.
+ * With workers only the rest of formats is left to them, so the sample is taken from the files of the format.
+ */
+string cost_sample(const vector<fs::path> &current_format_file_paths, const vector<fs::path> &other_formats_file_paths){
+  if (!count_workers.empty())
+    return read_sample(current_format_file_paths, cost_sample_size);
+  return read_sample(current_format_file_paths, cost_sample_size/2) + read_sample(other_formats_file_paths, cost_sample_size/2);
+}
+
+
+/**
+ * @brief Estimates what an expression costs to the classifier: the transitions per byte of its automaton
+ * over the sample, plus one for every 64 states, the rows of a 64KB transition table. The automaton of an
+ * expression which exceeds count_max_states has the cost of the whole table.
+ */
+double scan_cost(const string &regex, const string &sample){
+  Nfa nfa;
+  Dfa dfa;
+  MatchCounter counter;
+  nfa.addRegex(regex);
+  if (sample.empty() || !dfa.build(nfa, count_max_states))
+    return count_max_states / 64.0;
+  counter.reset(dfa, 1);
+  counter.feed(sample.data(), sample.size());
+  return (double)counter.steps() / sample.size() + dfa.states() / 64.0;
+}
+
+
+/**
+ * @brief Returns the scan cost of every expression of the pool. The costs are kept while the sample is the same.
+ */
+vector<double> scan_costs(const vector<PoolRegex> &pool, const string &sample){
+  TraceScope scope("scan_cost");
+  if (sample != scan_cost_sample){
+    scan_cost_sample = sample;
+    scan_cost_entries.clear();
+  }
+  vector<double> costs(pool.size());
+  for (int i=0; i < pool.size(); i++){
+    const string &regex = pool[i].toString();
+    unordered_map<string, double>::iterator it = scan_cost_entries.find(regex);
+    if (it == scan_cost_entries.end())
+      it = scan_cost_entries.insert(pair<string, double>(regex, scan_cost(regex, sample))).first;
+    costs[i] = it->second;
+  }
+  return costs;
+}
+
+
+/**
+ * @brief Returns the Pareto front of each expression for a high goodness and a low cost: 0 for the ones which
+ * no other expression beats in both, 1 for the ones only beaten by the front 0, and so on. The expressions
+ * without goodness are left after every front.
+ */
+vector<int> pareto_fronts(const vector<double> &goodness, const vector<double> &costs){
+  vector<int> fronts(goodness.size(), -1);
+  int front = 0;
+  size_t assigned = 0;
+  for (size_t i=0; i < goodness.size(); i++)
+    if (goodness[i] <= 0){
+      fronts[i] = goodness.size();
+      assigned++;
+    }
+  while (assigned < goodness.size()){
+    vector<size_t> current;
+    for (size_t i=0; i < goodness.size(); i++){
+      if (fronts[i] >= 0)
+        continue;
+      bool dominated = false;
+      for (size_t j=0; j < goodness.size() && !dominated; j++)
+        dominated = j != i && fronts[j] < 0 && goodness[j] >= goodness[i] && costs[j] <= costs[i] &&
+                    (goodness[j] > goodness[i] || costs[j] < costs[i]);
+      if (!dominated)
+        current.push_back(i);
+    }
+    for (size_t i=0; i < current.size(); i++)
+      fronts[current[i]] = front;
+    assigned += current.size();
+    front++;
+  }
+  return fronts;
+}
+
+
+/**
+ * @brief Returns the goodness of an expression: the matches per byte in the files of its format, divided by
+ * 1000 times the matches per byte in the rest plus 1. Expressions longer than 40 atoms get 0.
+ */
+double regex_goodness(const PoolRegex &regex, uint64_t current_format_matches, uint64_t other_format_matches, uint64_t current_format_chars_count, uint64_t other_formats_chars_count){
+  if (regex.length() > 40)
+    return 0;
+  double current_matches_mean = (long double)current_format_matches / (long double)current_format_chars_count;
+  double other_matches_mean = (long double)other_format_matches / (long double)other_formats_chars_count;
+  return current_matches_mean / (1000*other_matches_mean + 1);
+}
+
+
+/**
+ * @brief Builds the initial pool from the byte n-grams, character class patterns and words which best tell
+ * the format apart from the rest, according to the goodness of select_fittest. Half of the pool is seeded
+ * this way and the rest are basic_pool elements, as in buildInitialPool. With workers, the files of the rest
+ * of formats aren't read here: the candidates most frequent in the format are counted by the workers in the
+ * rest and ranked with regex_goodness.
+ * @param pool Vector to store the pool.
+ * @param p Pool size.
+ * @param current_format_file_paths Paths of the files of the format.
+ * @param other_formats_file_paths Paths of the rest of training files.
+ */
+void seedInitialPool(vector<PoolRegex> &pool, int p, const vector<fs::path> &current_format_file_paths, const vector<fs::path> &other_formats_file_paths){
+  TraceScope scope("seed_pool");
+  cerr << "Seeding initial pool" << endl;
+  NgramStats stats;
+  vector<string> current_paths, other_paths;
+  for (vector<fs::path>::const_iterator it = current_format_file_paths.begin(); it != current_format_file_paths.end(); ++it)
+    current_paths.push_back(it->string());
+  if (count_workers.empty())
+    for (vector<fs::path>::const_iterator it = other_formats_file_paths.begin(); it != other_formats_file_paths.end(); ++it)
+      other_paths.push_back(it->string());
+  if (!stats.build(current_paths, other_paths, thread::hardware_concurrency()))
+    cerr << "Some training files can't be read" << endl;
+
+  if (count_workers.empty()){
+    vector<NgramStats::Candidate> seeds = stats.best(p/2);
+    for (size_t i=0; i < seeds.size(); i++)
+      pool.push_back(PoolRegex(&seeds[i].atoms[0], seeds[i].atoms.size()));
+  } else {
+    vector<NgramStats::Candidate> candidates = stats.best(seed_candidates_factor*(p/2));
+    vector<PoolRegex> seeds;
+    for (size_t i=0; i < candidates.size(); i++)
+      seeds.push_back(PoolRegex(&candidates[i].atoms[0], candidates[i].atoms.size()));
+    vector<uint64_t> current_format_matches = count_matches(seeds, current_format_file_paths);
+    vector<uint64_t> other_format_matches = count_matches(seeds, other_formats_file_paths);
+    uint64_t current_format_chars_count = files_bytes(current_format_file_paths);
+    uint64_t other_formats_chars_count = files_bytes(other_formats_file_paths);
+    vector<pair<double, int> > ranked;
+    for (size_t i=0; i < seeds.size(); i++)
+      ranked.push_back(make_pair(-regex_goodness(seeds[i], current_format_matches[i], other_format_matches[i], current_format_chars_count, other_formats_chars_count), i));
+    sort(ranked.begin(), ranked.end());
+    for (int i=0; i < ranked.size() && i < p/2; i++)
+      pool.push_back(seeds[ranked[i].second]);
+  }
+  for (int i=pool.size(); i < p; i++)
+    pool.push_back(basic_regexs[rand() % basic_size]);
+}
+
+
+/**
+ * @brief std::set<pairRegex*, double> comparator.
+ */
+struct Cmp {
+  bool operator() (const pair<PoolRegex*, double>& lpair, const pair<PoolRegex*, double>& rpair) const{
+    return lpair.second > rpair.second;
+  }
+};
+
+/**
+ * @brief Select the k best expressions in the pool. By default the fittest are the ones with the best
+ * goodness; with cost_weight the goodness is divided by 1 + cost_weight * scan cost, and with pareto_selection
+ * the expressions of the first Pareto fronts of goodness and scan cost are kept first. The goodness returned
+ * is always the one of the expressions, which the classifiers use.
+ * @param pool Pool from which select the expressions.
+ * @param k Number of expressions to select.
+ * @param current_format_matches Matches of each expression of the pool in current_format_files. They're
+ * reordered with the pool, so they're left with the matches of the selected expressions.
+ * @param other_format_matches Matches of each expression of the pool in other_format_files, reordered too.
+ * @param current_format_chars_count Bytes of the files of the format, as files_bytes returns them.
+ * @param other_formats_chars_count Bytes of the rest of the training files.
+ * @param current_format_file_paths Paths of the files with the format in which the expressions must be trained.
+ * @param other_formats_file_paths Paths of the rest of the training files.
+ */
+vector<double> select_counted(vector<PoolRegex> &pool, int k, vector<uint64_t> &current_format_matches, vector<uint64_t> &other_format_matches, uint64_t current_format_chars_count, uint64_t other_formats_chars_count, const vector<fs::path> &current_format_file_paths, const vector<fs::path> &other_formats_file_paths){
+  vector<double> costs;
+  if (cost_weight > 0 || pareto_selection)
+    costs = scan_costs(pool, cost_sample(current_format_file_paths, other_formats_file_paths));
+  TraceScope scope("selection");
+  set<pair<PoolRegex*, double>, Cmp> regex_goodness_set;
+
+  cerr << "Selecting fittest" << endl;
+  vector<double> pool_goodness(pool.size());
+  for (int i=0; i < pool.size(); i++)
+    pool_goodness[i] = regex_goodness(pool[i], current_format_matches[i], other_format_matches[i], current_format_chars_count, other_formats_chars_count);
+  vector<int> fronts;
+  if (pareto_selection)
+    fronts = pareto_fronts(pool_goodness, costs);
+  for (int i=0; i < pool.size(); i++){
+    pair<PoolRegex*, double> p;
+    p.first = &(pool[i]);
+    p.second = pool_goodness[i];
+    if (pareto_selection)
+      // g/(g+1) < 1 orders the expressions of each front without mixing the fronts
+      p.second = pool_goodness[i] / (pool_goodness[i] + 1) - fronts[i];
+    else if (cost_weight > 0)
+      p.second = pool_goodness[i] / (1 + cost_weight * costs[i]);
+    regex_goodness_set.insert(p);
+  }
+
+  vector<double> goodness;
+  vector<PoolRegex> new_pool;
+  vector<uint64_t> new_current_matches, new_other_matches;
+  int i = 0;
+  for (set<std::pair<PoolRegex*, double>, Cmp>::iterator it = regex_goodness_set.begin(); i < k && it != regex_goodness_set.end(); i++, ++it){
+    int index = it->first - &pool[0];
+    cerr << *(it->first) << " (" << pool_goodness[index];
+    if (!costs.empty())
+      cerr << ", cost " << costs[index];
+    cerr << ")" << endl;
+    new_pool.push_back(std::move(*(it->first)));
+    new_current_matches.push_back(current_format_matches[index]);
+    new_other_matches.push_back(other_format_matches[index]);
+    goodness.push_back(pool_goodness[index]);
+  }
+  cerr << endl <<  "------------------------------------" << endl << endl;
+  pool.swap(new_pool);
+  current_format_matches.swap(new_current_matches);
+  other_format_matches.swap(new_other_matches);
+
+  return goodness;
+}
+
+
+/**
+ * @brief Select the k best expressions in the pool, like select_counted, counting their matches first.
+ */
+vector<double> select_fittest(vector<PoolRegex> &pool, int k, const vector<fs::path> &current_format_file_paths, const vector<fs::path> &other_formats_file_paths){
+  vector<uint64_t> current_format_matches = count_matches(pool, current_format_file_paths);
+  vector<uint64_t> other_format_matches = count_matches(pool, other_formats_file_paths);
+  return select_counted(pool, k, current_format_matches, other_format_matches, files_bytes(current_format_file_paths), files_bytes(other_formats_file_paths), current_format_file_paths, other_formats_file_paths);
+}
+
+
+/**
+ * @brief Measures the MB/s with which the automaton of some expressions scans a sample, as the classifiers
+ * do. The sample is repeated until 1MB and the median of 5 scans is kept.
+ * @return 0 if the automaton exceeds the states of the classifiers.
+ */
+double measure_throughput(const vector<PoolRegex> &pool, const string &sample){
+  Nfa nfa;
+  Dfa dfa;
+  MatchCounter counter;
+  string input;
+  for (int i=0; i < pool.size(); i++)
+    nfa.addRegex(pool[i].toString());
+  if (sample.empty() || !dfa.build(nfa, 1 << 16))
+    return 0;
+  while (input.size() < (1 << 20))
+    input += sample;
+  vector<double> times;
+  for (int r=0; r < 5; r++){
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    counter.reset(dfa, pool.size());
+    counter.feed(input.data(), input.size());
+    times.push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+  }
+  sort(times.begin(), times.end());
+  return times[2] > 0 ? input.size() / times[2] / (1 << 20) : 0;
+}
+
+
+/**
+ * @brief Drops expressions of the final pool until their automaton reaches target_throughput. Each time the
+ * expression with the highest scan cost per goodness is dropped, so the least useful slow expressions go
+ * first. At least one expression is kept.
+ * @param goodness Goodness of each expression, which is dropped alongside it.
+ */
+void meet_throughput(vector<PoolRegex> &pool, vector<double> &goodness, const vector<fs::path> &current_format_file_paths, const vector<fs::path> &other_formats_file_paths){
+  string sample = cost_sample(current_format_file_paths, other_formats_file_paths);
+  double throughput = measure_throughput(pool, sample);
+  while (throughput < target_throughput && pool.size() > 1){
+    vector<double> costs = scan_costs(pool, sample);
+    int worst = 0;
+    for (int i=1; i < pool.size(); i++)
+      // cost/goodness compared without dividing, so the expressions without goodness go first
+      if (costs[i] * goodness[worst] > costs[worst] * goodness[i])
+        worst = i;
+    cerr << "Dropping " << pool[worst] << " (" << throughput << " MB/s)" << endl;
+    pool.erase(pool.begin() + worst);
+    goodness.erase(goodness.begin() + worst);
+    throughput = measure_throughput(pool, sample);
+  }
+  cerr << "Throughput of the final expressions: " << throughput << " MB/s" << endl;
+}
+
+
+/**
+ * @brief Fills the pool until reach the size p.
+ * @param pool Pool to fill.
+ * @param p Size of the complete pool.
+ * @param words Index of the words of the files with the format in which the expressions must be trained. Is used to call the insertWordsFromFiles funtion.
+ */
+void complete_pool(vector<PoolRegex> &pool, int p, double epsilon, const WordIndex &words){
+  TraceScope scope("complete_pool");
+  int free_pool_size = p - pool.size();
+
+  // 1/3 of the free space is filled with genetic operations.
+  genetic_operations(pool, (int)(1.0/3 * free_pool_size), epsilon);
+
+  // 1/5 of the free space is filled with words extracted from the files
+  insertWordsFromFiles(pool, words, (int)(1.0/5 * free_pool_size));
+
+  // The rest of the free space is filled with some basic_pool elements
+  for (int i=pool.size(); i < p; i++)
+    pool.push_back(basic_regexs[rand() % basic_size]);
+}
+
+
+/**
+ * @brief Breeds the expressions which complete_pool would add to the pool, but returns them apart and
+ * leaves the pool as it was.
+ * @param pool Parents of the new expressions.
+ * @param p Size of the pool with the new expressions.
+ */
+vector<PoolRegex> breed(vector<PoolRegex> &pool, int p, double epsilon, const WordIndex &words){
+  int parents = pool.size();
+  complete_pool(pool, p, epsilon, words);
+  vector<PoolRegex> offspring(make_move_iterator(pool.begin() + parents), make_move_iterator(pool.end()));
+  pool.erase(pool.begin() + parents, pool.end());
+  return offspring;
+}
+
+
+/**
+ * @brief Counts in other thread the matches of some expressions in the files of the current format and in
+ * the rest. The thread only uses the strings of the expressions, so the main one can go on building
+ * expressions, but it must be the only one which counts until the result is taken.
+ * @param regexs Expressions to count.
+ * @return The matches in current_format_file_paths and in other_formats_file_paths.
+ */
+future<pair<vector<uint64_t>, vector<uint64_t> > > count_batch(const vector<string> &regexs, const vector<fs::path> &current_format_file_paths, const vector<fs::path> &other_formats_file_paths){
+  return async(launch::async, [regexs, &current_format_file_paths, &other_formats_file_paths](){
+    return make_pair(count_matches(regexs, current_format_file_paths), count_matches(regexs, other_formats_file_paths));
+  });
+}
+
+
+/**
+ * @brief Two arenas which hold alternately the expressions of each generation. After the selection, the
+ * survivors are relocated to the other arena, which is reset first, and the candidates of the next generation
+ * are built there too. So the memory of every discarded candidate is released at once and, after the first
+ * generations, nothing is asked to the system.
+ */
+class GenerationArenas{
+private:
+  Arena m_arenas[2];
+  int m_current;
+
+public:
+
+  GenerationArenas(){
+    m_current = 0;
+    Regex::useArena(&m_arenas[m_current]);
+  }
+
+  ~GenerationArenas(){
+    Regex::useArena(NULL);
+  }
+
+  /**
+   * @brief Starts a new generation whose first expressions are the survivors in pool.
+   */
+  void next(vector<Regex> &pool){
+    m_current = 1 - m_current;
+    m_arenas[m_current].reset();
+    Regex::useArena(&m_arenas[m_current]);
+    for (vector<Regex>::iterator it = pool.begin(); it != pool.end(); ++it)
+      it->relocate();
+  }
+
+  /**
+   * @brief Relocates to the current arena expressions built during the previous generation which must
+   * survive to the next one, like the survivors passed to next.
+   */
+  void keep(vector<Regex> &regexs){
+    for (vector<Regex>::iterator it = regexs.begin(); it != regexs.end(); ++it)
+      it->relocate();
+  }
+
+  /**
+   * @brief The nodes of RegexDag are shared between generations and freed when they aren't referenced.
+   */
+  void next(vector<RegexDag> &pool){}
+
+  void keep(vector<RegexDag> &regexs){}
+
+  /**
+   * @brief Returns the bytes reserved by the arenas.
+   */
+  size_t capacity() const{
+    return m_arenas[0].capacity() + m_arenas[1].capacity();
+  }
+};
+
+
+/**
+ * @brief Binary heap of the slots of a pool, with the slot of the lowest key on top. It knows where each
+ * slot is, so the key of any slot can be changed in O(log n) without searching it.
+ */
+class IndexedHeap{
+private:
+  vector<int> m_heap;
+  vector<int> m_position;
+  vector<double> m_keys;
+
+  void swapPositions(int i, int j){
+    swap(m_heap[i], m_heap[j]);
+    m_position[m_heap[i]] = i;
+    m_position[m_heap[j]] = j;
+  }
+
+  void siftUp(int i){
+    while (i > 0 && m_keys[m_heap[i]] < m_keys[m_heap[(i-1)/2]]){
+      swapPositions(i, (i-1)/2);
+      i = (i-1)/2;
+    }
+  }
+
+  void siftDown(int i){
+    for (int child; (child = 2*i + 1) < m_heap.size(); i = child){
+      if (child+1 < m_heap.size() && m_keys[m_heap[child+1]] < m_keys[m_heap[child]])
+        child++;
+      if (!(m_keys[m_heap[child]] < m_keys[m_heap[i]]))
+        break;
+      swapPositions(i, child);
+    }
+  }
+
+public:
+
+  /**
+   * @brief Adds the next slot, numbered from 0 in the order they're added.
+   */
+  void push(double key){
+    int slot = m_keys.size();
+    m_keys.push_back(key);
+    m_position.push_back(m_heap.size());
+    m_heap.push_back(slot);
+    siftUp(m_heap.size()-1);
+  }
+
+  /**
+   * @brief Changes the key of a slot.
+   */
+  void update(int slot, double key){
+    m_keys[slot] = key;
+    siftUp(m_position[slot]);
+    siftDown(m_position[slot]);
+  }
+
+  /**
+   * @brief Returns the slot with the lowest key.
+   */
+  int top() const{
+    return m_heap[0];
+  }
+
+  double key(int slot) const{
+    return m_keys[slot];
+  }
+
+  int size() const{
+    return m_heap.size();
+  }
+};
+
+
+/**
+ * @brief Lists the training files of a format and the files of the rest of formats. They aren't opened: with
+ * workers, the files of the rest of formats are only read by them.
+ * @param current_format_path Path to the folder which contains the files with the format in which the expressions will be trained.
+ * @param root_path Path to the folder which contains all the folders with the training files.
+ */
+void list_training_files(const fs::path &current_format_path, const fs::path &root_path, vector<fs::path> &current_format_file_paths, vector<fs::path> &other_formats_file_paths){
+  fs::directory_iterator end_it;
+
+  for(fs::directory_iterator it(root_path/current_format_path); it != end_it; ++it)
+    if (likely(fs::is_regular_file(it->status())))
+      current_format_file_paths.push_back(fs::system_complete(*it));
+
+  for(fs::directory_iterator it(root_path); it != end_it; ++it)
+    if (likely(fs::is_directory(it->status())) && *it != current_format_path)
+      for(fs::directory_iterator dir_it(*it); dir_it != end_it; ++dir_it)
+        if (likely(fs::is_regular_file(dir_it->status())))
+          other_formats_file_paths.push_back(fs::system_complete(*dir_it));
+}
+
+
+/**
+ * @brief Adds the byte distribution of a format to the prestage of the model.
+ * @param current_format_path Path to the folder which contains the files of the format.
+ * @param root_path Path to the folder which contains all the folders with the training files.
+ */
+void train_prestage(Prestage &prestage, const fs::path &current_format_path, const fs::path &root_path){
+  vector<string> files;
+  fs::directory_iterator end_it;
+
+  for(fs::directory_iterator it(root_path/current_format_path); it != end_it; ++it)
+    if (likely(fs::is_regular_file(it->status()))){
+      ifstream ifs(fs::system_complete(*it).string(), ios::binary);
+      files.push_back(string(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>()));
+    }
+  prestage.addFormat(current_format_path.string(), files);
+}
+
+
+/**
+ * @brief How well the expressions tell apart the formats of the training files: the mean, over the files,
+ * of the reliability of the format of the file minus the highest reliability of the rest, and the files
+ * whose format gets the highest reliability.
+ */
+struct Separation{
+  double margin;
+  int hits;
+  vector<bool> recognized;
+};
+
+
+/**
+ * @brief Calculates the separation of the training files from the sum of goodness times matches of every
+ * format in each file.
+ * @param sums sums[file][format], the value whose reliability is sum/(sum+100).
+ * @param file_formats Format of each file.
+ */
+Separation separation(const vector<vector<double> > &sums, const vector<int> &file_formats){
+  Separation result = {0, 0, vector<bool>(sums.size(), false)};
+  for (size_t f=0; f < sums.size(); f++){
+    double own = 0, best_other = 0;
+    for (size_t g=0; g < sums[f].size(); g++){
+      double reliability = sums[f][g] / (sums[f][g] + 100);
+      if ((int)g == file_formats[f])
+        own = reliability;
+      else
+        best_other = max(best_other, reliability);
+    }
+    result.margin += own - best_other;
+    result.recognized[f] = own > best_other;
+    result.hits += result.recognized[f];
+  }
+  if (!sums.empty())
+    result.margin /= sums.size();
+  return result;
+}
+
+
+/**
+ * @brief Removes the expressions which add little to the separation of the formats. The matches of every
+ * expression in every training file are counted once; then, while some removal keeps recognized every file
+ * which was recognized at first and loses at most tolerance times the absolute value of the original margin,
+ * the expression whose removal loses the least margin is removed. Near-identical expressions and the ones whose matches are negligible go first. Every format
+ * keeps at least one expression.
+ * @param output_template Template with the trained expressions, which is replaced by the pruned ones.
+ * @param root_path Path to the folder which contains all the folders with the training files.
+ * @param tolerance Fraction of the absolute value of the original margin which can be lost.
+ */
+void prune_expressions(OutputTemplate &output_template, const fs::path &root_path, double tolerance){
+  const map<string, vector<pair<string, double> > > &regex_data = output_template.regexData();
+  vector<string> format_names;
+  vector<string> regexs;
+  vector<int> regex_formats;
+  vector<double> regex_goodness;
+  vector<pair<string, double> > entries;
+  for (map<string, vector<pair<string, double> > >::const_iterator it = regex_data.begin(); it != regex_data.end(); ++it){
+    for (size_t i=0; i < it->second.size(); i++){
+      entries.push_back(it->second[i]);
+      regexs.push_back(it->second[i].first);
+      regex_formats.push_back(format_names.size());
+      // The classifiers use the goodness with the precision of the generated programs
+      regex_goodness.push_back(strtod(to_string(it->second[i].second).c_str(), NULL));
+    }
+    format_names.push_back(it->first);
+  }
+
+  vector<fs::path> file_paths;
+  vector<int> file_formats;
+  fs::directory_iterator end_it;
+  for (size_t i=0; i < format_names.size(); i++)
+    for (fs::directory_iterator it(root_path/format_names[i]); it != end_it; ++it)
+      if (likely(fs::is_regular_file(it->status()))){
+        file_paths.push_back(fs::system_complete(*it));
+        file_formats.push_back(i);
+      }
+
+  // matches[file][regex]
+  vector<vector<uint64_t> > matches(file_paths.size(), vector<uint64_t>(regexs.size(), 0));
+  vector<Dfa> dfas;
+  vector<int> dfa_regexs;
+  build_count_dfas(regexs, 0, regexs.size(), dfas, dfa_regexs);
+  dfa_regexs.push_back(regexs.size());
+  vector<char> buffer(1 << 16);
+  for (size_t f=0; f < file_paths.size(); f++){
+    ifstream file(file_paths[f].string(), ifstream::binary);
+    vector<MatchCounter> counters(dfas.size());
+    for (size_t i=0; i < dfas.size(); i++)
+      counters[i].reset(dfas[i], dfa_regexs[i+1] - dfa_regexs[i]);
+    while (file.read(&buffer[0], buffer.size()) || file.gcount() > 0)
+      for (size_t i=0; i < dfas.size(); i++)
+        counters[i].feed(&buffer[0], file.gcount());
+    for (size_t i=0; i < dfas.size(); i++)
+      for (int j=dfa_regexs[i]; j < dfa_regexs[i+1]; j++)
+        matches[f][j] = counters[i].counts()[j - dfa_regexs[i]];
+  }
+  vector<vector<double> > sums(file_paths.size(), vector<double>(format_names.size(), 0));
+  for (size_t f=0; f < file_paths.size(); f++)
+    for (size_t r=0; r < regexs.size(); r++)
+      sums[f][regex_formats[r]] += regex_goodness[r] * matches[f][r];
+
+  Separation original = separation(sums, file_formats), current = original;
+  double min_margin = original.margin - tolerance * fabs(original.margin);
+  vector<bool> removed(regexs.size(), false);
+  vector<int> format_regexs(format_names.size(), 0);
+  for (size_t r=0; r < regexs.size(); r++)
+    format_regexs[regex_formats[r]]++;
+  while (true){
+    int best = -1;
+    Separation best_separation = {0, 0, vector<bool>()};
+    for (size_t r=0; r < regexs.size(); r++){
+      if (removed[r] || format_regexs[regex_formats[r]] <= 1)
+        continue;
+      for (size_t f=0; f < file_paths.size(); f++)
+        sums[f][regex_formats[r]] -= regex_goodness[r] * matches[f][r];
+      Separation without = separation(sums, file_formats);
+      for (size_t f=0; f < file_paths.size(); f++)
+        sums[f][regex_formats[r]] += regex_goodness[r] * matches[f][r];
+      bool keeps_files = true;
+      for (size_t f=0; f < file_paths.size() && keeps_files; f++)
+        keeps_files = without.recognized[f] || !original.recognized[f];
+      if (keeps_files && without.margin >= min_margin && (best < 0 || without.margin > best_separation.margin)){
+        best = r;
+        best_separation = without;
+      }
+    }
+    if (best < 0)
+      break;
+    for (size_t f=0; f < file_paths.size(); f++)
+      sums[f][regex_formats[best]] -= regex_goodness[best] * matches[f][best];
+    removed[best] = true;
+    format_regexs[regex_formats[best]]--;
+    current = best_separation;
+  }
+
+  OutputTemplate pruned;
+  int kept = 0;
+  for (size_t r=0; r < regexs.size(); r++)
+    if (!removed[r]){
+      pruned.addRegex(format_names[regex_formats[r]], entries[r].first, entries[r].second);
+      kept++;
+    }
+  cout << "Pruned " << regexs.size() - kept << " of " << regexs.size() << " expressions (margin " << original.margin
+       << " -> " << current.margin << ", " << current.hits << "/" << file_paths.size() << " files recognized)" << endl;
+  output_template = pruned;
+}
+
+
+/**
+ * @brief Trains the expressions in order to adjust it to the format indicated by current_format_path.
+ * @param current_format_path Path to the folder which contains the files with the format in which the expressions will be trained.
+ * @param root_path Path to the folder which contains all the folders with the training files.
+ * @param output_template OutputTemplate in wich the training expresions will be written.
+ * @param n Number of iterations of the training.
+ * @param p Size of the pool.
+ * @param k Number of selected expressions after each iteration.
+ * @param k_0 Number of seleccted expressions after the last interation.
+ * @param epsilon Muttation probability. Must be a value between 0 and 1.
+ */
+void training(const fs::path &current_format_path, const fs::path &root_path, OutputTemplate &output_template, int n, int p, int k, int k_0, double epsilon){
+  vector<fs::path> current_format_file_paths;
+  vector<fs::path> other_formats_file_paths;
+
+  list_training_files(current_format_path, root_path, current_format_file_paths, other_formats_file_paths);
+  // Taken before any count runs in other thread, which also records the bytes of the workers
+  uint64_t current_format_chars_count = files_bytes(current_format_file_paths);
+  uint64_t other_formats_chars_count = files_bytes(other_formats_file_paths);
+
+
+  cout << "Training expressions " << current_format_path.string() << " (0%)" << flush;
+
+  WordIndex words;
+  vector<string> word_paths;
+  for (vector<fs::path>::iterator it = current_format_file_paths.begin(); it != current_format_file_paths.end(); ++it)
+    word_paths.push_back(it->string());
+  if (!words.build(word_paths))
+    cerr << "The files of " << current_format_path.string() << " can't be indexed" << endl;
+
+  // Declared before the pool, which must be destroyed before the arenas
+  GenerationArenas arenas;
+  vector<PoolRegex> pool;
+  if (seed_pool)
+    seedInitialPool(pool, p, current_format_file_paths, other_formats_file_paths);
+  else
+    buildInitialPool(pool, p);
+  vector<double> goodness;
+  if (pipelined_generations && steady_batch == 0 && n > 0){
+    // The offspring of each generation are bred from the survivors of the previous one while the offspring
+    // of the current one are counted, and counted while the current generation is selected. The survivors
+    // keep their counts, so only the offspring are counted
+    vector<uint64_t> current_format_matches, other_format_matches;
+    vector<PoolRegex> offspring = breed(pool, p, epsilon, words);
+    vector<string> batch = regex_strings(pool), offspring_strings = regex_strings(offspring);
+    batch.insert(batch.end(), offspring_strings.begin(), offspring_strings.end());
+    future<pair<vector<uint64_t>, vector<uint64_t> > > counted = count_batch(batch, current_format_file_paths, other_formats_file_paths);
+    for (int i=0; i < n; i++){
+      vector<PoolRegex> next_offspring;
+      if (i+1 < n)
+        next_offspring = breed(pool, pool.size() + p - k, epsilon, words);
+      pair<vector<uint64_t>, vector<uint64_t> > counts = counted.get();
+      if (i+1 < n)
+        counted = count_batch(regex_strings(next_offspring), current_format_file_paths, other_formats_file_paths);
+      pool.insert(pool.end(), make_move_iterator(offspring.begin()), make_move_iterator(offspring.end()));
+      current_format_matches.insert(current_format_matches.end(), counts.first.begin(), counts.first.end());
+      other_format_matches.insert(other_format_matches.end(), counts.second.begin(), counts.second.end());
+      trace.generation(current_format_path.string(), i, select_counted(pool, k, current_format_matches, other_format_matches, current_format_chars_count, other_formats_chars_count, current_format_file_paths, other_formats_file_paths));
+      arenas.next(pool);
+      arenas.keep(next_offspring);
+      offspring.swap(next_offspring);
+      cout << "\rTraining expressions " << current_format_path.string() << " (" << 100*i/n << "%)" << flush;
+    }
+    goodness = select_counted(pool, k_0, current_format_matches, other_format_matches, current_format_chars_count, other_formats_chars_count, current_format_file_paths, other_formats_file_paths);
+  } else if (steady_batch > 0 && n > 0){
+    // The pool is counted once, and then each step only counts its offspring. An offspring replaces the
+    // worst expression if it's fitter and no expression of the pool has its fitness, as the selection keeps
+    // one expression per goodness. Each generation has the steps which count as many offspring as p - k
+    string sample;
+    if (cost_weight > 0)
+      sample = cost_sample(current_format_file_paths, other_formats_file_paths);
+    complete_pool(pool, p, epsilon, words);
+    vector<uint64_t> current_format_matches = count_matches(pool, current_format_file_paths);
+    vector<uint64_t> other_format_matches = count_matches(pool, other_formats_file_paths);
+    goodness = select_counted(pool, p, current_format_matches, other_format_matches, current_format_chars_count, other_formats_chars_count, current_format_file_paths, other_formats_file_paths);
+    IndexedHeap worst;
+    set<double> fitnesses;
+    vector<double> costs(pool.size(), 0);
+    if (cost_weight > 0)
+      costs = scan_costs(pool, sample);
+    for (int i=0; i < pool.size(); i++){
+      worst.push(goodness[i] / (1 + cost_weight * costs[i]));
+      fitnesses.insert(worst.key(i));
+    }
+
+    int steps = max(1, (p - k) / steady_batch);
+    for (int i=0; i < n; i++){
+      for (int step=0; step < steps; step++){
+        vector<PoolRegex> offspring = breed(pool, pool.size() + steady_batch, epsilon, words);
+        vector<string> offspring_strings = regex_strings(offspring);
+        vector<uint64_t> offspring_current_matches = count_matches(offspring_strings, current_format_file_paths);
+        vector<uint64_t> offspring_other_matches = count_matches(offspring_strings, other_formats_file_paths);
+        vector<double> offspring_costs(offspring.size(), 0);
+        if (cost_weight > 0)
+          offspring_costs = scan_costs(offspring, sample);
+        TraceScope scope("replacement");
+        for (int j=0; j < offspring.size(); j++){
+          double offspring_goodness = regex_goodness(offspring[j], offspring_current_matches[j], offspring_other_matches[j], current_format_chars_count, other_formats_chars_count);
+          double fitness = offspring_goodness / (1 + cost_weight * offspring_costs[j]);
+          if (fitnesses.count(fitness) > 0)
+            continue;
+          int slot = worst.size();
+          if (slot < p){
+            pool.push_back(std::move(offspring[j]));
+            current_format_matches.push_back(offspring_current_matches[j]);
+            other_format_matches.push_back(offspring_other_matches[j]);
+            goodness.push_back(offspring_goodness);
+            worst.push(fitness);
+          } else if (fitness > worst.key(worst.top())){
+            slot = worst.top();
+            fitnesses.erase(worst.key(slot));
+            pool[slot] = std::move(offspring[j]);
+            current_format_matches[slot] = offspring_current_matches[j];
+            other_format_matches[slot] = offspring_other_matches[j];
+            goodness[slot] = offspring_goodness;
+            worst.update(slot, fitness);
+          } else {
+            continue;
+          }
+          fitnesses.insert(fitness);
+        }
+      }
+      trace.generation(current_format_path.string(), i, goodness);
+      arenas.next(pool);
+      cout << "\rTraining expressions " << current_format_path.string() << " (" << 100*i/n << "%)" << flush;
+    }
+    goodness = select_counted(pool, k_0, current_format_matches, other_format_matches, current_format_chars_count, other_formats_chars_count, current_format_file_paths, other_formats_file_paths);
+  } else {
+    for (int i=0; i < n; i++){
+      complete_pool(pool, p, epsilon, words);
+      trace.generation(current_format_path.string(), i, select_fittest(pool, k, current_format_file_paths, other_formats_file_paths));
+      arenas.next(pool);
+      cout << "\rTraining expressions " << current_format_path.string() << " (" << 100*i/n << "%)" << flush;
+    }
+    goodness = select_fittest(pool, k_0, current_format_file_paths, other_formats_file_paths);
+  }
+  if (target_throughput > 0)
+    meet_throughput(pool, goodness, current_format_file_paths, other_formats_file_paths);
+  trace.generation(current_format_path.string(), n, goodness);
+  cout << "\rTraining expressions " << current_format_path.string() << " (100%)" << flush << endl;
+
+  for (int i=0; i < pool.size(); i++)
+    output_template.addRegex(current_format_path.string(), pool[i].toString(), goodness[i]);
+}
+
+#endif
@@ -0,0 +1,147 @@
+/**
+ * @file transport.hpp
+ * @brief Line based connections over Unix or TCP sockets, used to count the matches in worker processes
+ */
+
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+
+/**
+ * @brief Opens a socket listening on an address or connected to it.
+ * @param address "unix:<path>" for a Unix socket or "<host>:<port>" for TCP. The host of a listening socket
+ * may be empty to listen on every interface.
+ * @param listening Whether the socket listens on the address instead of connecting to it.
+ * @return The descriptor of the socket, or -1 if it can't be opened.
+ */
+inline int openSocket(const std::string &address, bool listening){
+  if (address.compare(0, 5, "unix:") == 0){
+    struct sockaddr_un unix_address;
+    std::string path = address.substr(5);
+    memset(&unix_address, 0, sizeof(unix_address));
+    unix_address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(unix_address.sun_path))
+      return -1;
+    strcpy(unix_address.sun_path, path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      return -1;
+    if (listening)
+      unlink(path.c_str());
+    bool ok = listening ? bind(fd, (struct sockaddr*)&unix_address, sizeof(unix_address)) == 0 && listen(fd, 128) == 0
+                        : connect(fd, (struct sockaddr*)&unix_address, sizeof(unix_address)) == 0;
+    if (!ok){
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  size_t colon = address.rfind(':');
+  if (colon == std::string::npos)
+    return -1;
+  std::string host = address.substr(0, colon), port = address.substr(colon+1);
+  struct addrinfo hints, *results;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = listening ? AI_PASSIVE : 0;
+  if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &results) != 0)
+    return -1;
+  int fd = -1;
+  for (struct addrinfo* it = results; it != NULL && fd < 0; it = it->ai_next){
+    fd = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+    if (fd < 0)
+      continue;
+    int one = 1;
+    bool ok;
+    if (listening){
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      ok = bind(fd, it->ai_addr, it->ai_addrlen) == 0 && listen(fd, 128) == 0;
+    } else {
+      ok = connect(fd, it->ai_addr, it->ai_addrlen) == 0;
+      // Requests are written at once and wait for their answer, so they aren't delayed to be merged
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if (!ok){
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(results);
+  return fd;
+}
+
+
+/**
+ * @brief Connection which exchanges lines of text over a socket. It owns the socket, which is closed with it.
+ */
+class LineChannel{
+private:
+  int m_fd;
+  std::string m_in;
+  size_t m_pos;
+
+  LineChannel(const LineChannel&);
+  LineChannel& operator=(const LineChannel&);
+
+public:
+
+  /**
+   * @param fd Connected socket.
+   */
+  LineChannel(int fd){
+    m_fd = fd;
+    m_pos = 0;
+  }
+
+  ~LineChannel(){
+    if (m_fd >= 0)
+      close(m_fd);
+  }
+
+  /**
+   * @brief Reads the next line, without its end.
+   * @return false if the connection is closed before the end of the line.
+   */
+  bool readLine(std::string &line){
+    char buffer[1 << 16];
+    size_t end;
+    while ((end = m_in.find('\n', m_pos)) == std::string::npos){
+      m_in.erase(0, m_pos);
+      m_pos = 0;
+      ssize_t n = read(m_fd, buffer, sizeof(buffer));
+      if (n <= 0)
+        return false;
+      m_in.append(buffer, n);
+    }
+    line.assign(m_in, m_pos, end - m_pos);
+    m_pos = end + 1;
+    return true;
+  }
+
+  /**
+   * @brief Writes data entirely.
+   * @return false if the connection is closed.
+   */
+  bool write(const std::string &data){
+    size_t written = 0;
+    ssize_t n;
+    while (written < data.size() && (n = ::write(m_fd, data.data() + written, data.size() - written)) > 0)
+      written += n;
+    return written == data.size();
+  }
+};
+
+#endif
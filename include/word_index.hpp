@@ -0,0 +1,172 @@
+/**
+ * @file word_index.hpp
+ * @brief Index of the words of the training files of a format
+ */
+
+#ifndef _WORD_INDEX_H_
+#define _WORD_INDEX_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+
+/**
+ * @brief Offsets and lengths of all the words (runs of characters which aren't isspace in the C locale)
+ * of some files. The files are mapped in memory and scanned once, 16 bytes at a time, so taking a word is
+ * an array lookup. Once built, the index isn't modified and can be read by several threads.
+ */
+class WordIndex{
+private:
+  struct Word{
+    uint64_t offset;
+    uint32_t file;
+    uint32_t length;
+  };
+
+  std::vector<const char*> m_data;
+  std::vector<size_t> m_sizes;
+  std::vector<Word> m_words;
+
+  /**
+   * @brief Returns a mask with a bit set for every whitespace among the 16 bytes of data.
+   */
+  static uint32_t whitespaceMask(const char* data){
+#ifdef __SSE2__
+    __m128i chars = _mm_loadu_si128((const __m128i*)data);
+    __m128i spaces = _mm_cmpeq_epi8(chars, _mm_set1_epi8(' '));
+    // '\t', '\n', '\v', '\f' and '\r' are the bytes whose distance to '\t' is at most 4
+    __m128i distance = _mm_sub_epi8(chars, _mm_set1_epi8('\t'));
+    __m128i controls = _mm_cmpeq_epi8(_mm_min_epu8(distance, _mm_set1_epi8(4)), distance);
+    return _mm_movemask_epi8(_mm_or_si128(spaces, controls));
+#else
+    uint32_t mask = 0;
+    for (int i=0; i < 16; i++)
+      if (isWhitespace(data[i]))
+        mask |= 1u << i;
+    return mask;
+#endif
+  }
+
+  static bool isWhitespace(char c){
+    return c == ' ' || (c >= '\t' && c <= '\r');
+  }
+
+  /**
+   * @brief Adds the words of a file.
+   */
+  void scan(uint32_t file){
+    const char* data = m_data[file];
+    size_t size = m_sizes[file], i = 0, start = 0;
+    bool in_word = false;
+
+    for (; i + 16 <= size; i += 16){
+      uint32_t mask = whitespaceMask(data + i);
+      // Bits where the text changes between whitespace and word, taking into account the previous chunk
+      uint32_t previous = (mask << 1) | (in_word ? 0 : 1);
+      uint32_t changes = (mask ^ previous) & 0xffff;
+      while (changes != 0){
+        int bit = __builtin_ctz(changes);
+        changes &= changes - 1;
+        if (in_word)
+          addWord(file, start, i + bit);
+        else
+          start = i + bit;
+        in_word = !in_word;
+      }
+    }
+    for (; i < size; i++)
+      if (isWhitespace(data[i]) == in_word){
+        if (in_word)
+          addWord(file, start, i);
+        else
+          start = i;
+        in_word = !in_word;
+      }
+    if (in_word)
+      addWord(file, start, size);
+  }
+
+  void addWord(uint32_t file, size_t start, size_t end){
+    Word word = {start, file, (uint32_t)(end - start)};
+    m_words.push_back(word);
+  }
+
+  void clear(){
+    for (size_t i=0; i < m_data.size(); i++)
+      if (m_sizes[i] > 0)
+        munmap((void*)m_data[i], m_sizes[i]);
+    m_data.clear();
+    m_sizes.clear();
+    m_words.clear();
+  }
+
+public:
+
+  WordIndex(){}
+
+  ~WordIndex(){
+    clear();
+  }
+
+  /**
+   * @brief Indexes the words of some files.
+   * @param paths Paths of the files.
+   * @return false if a file can't be read.
+   */
+  bool build(const std::vector<std::string> &paths){
+    clear();
+    for (size_t i=0; i < paths.size(); i++){
+      int fd = open(paths[i].c_str(), O_RDONLY);
+      struct stat info;
+      if (fd < 0)
+        return false;
+      if (fstat(fd, &info) != 0){
+        close(fd);
+        return false;
+      }
+      void* data = NULL;
+      if (info.st_size > 0 && (data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED){
+        close(fd);
+        return false;
+      }
+      close(fd);
+      m_data.push_back((const char*)data);
+      m_sizes.push_back(info.st_size);
+      if (info.st_size > 0){
+        madvise(data, info.st_size, MADV_SEQUENTIAL);
+        scan(m_data.size() - 1);
+        madvise(data, info.st_size, MADV_RANDOM);
+      }
+    }
+    return true;
+  }
+
+  /**
+   * @brief Returns the number of words.
+   */
+  size_t size() const{
+    return m_words.size();
+  }
+
+  /**
+   * @brief Returns the i-th word.
+   */
+  std::string word(size_t i) const{
+    return std::string(m_data[m_words[i].file] + m_words[i].offset, m_words[i].length);
+  }
+
+private:
+  WordIndex(const WordIndex&);
+  WordIndex& operator=(const WordIndex&);
+};
+
+#endif
@@ -0,0 +1,335 @@
+#include <chrono>
+#include <algorithm>
+#include <sstream>
+#include <random>
+#include "training.hpp"
+
+
+/**
+ * @brief Time per operation of a benchmark.
+ */
+struct BenchResult{
+  string name;
+  long iterations;
+  double ns_per_op;
+};
+
+vector<BenchResult> results;
+volatile long sink; // Keeps the compiler from removing the benchmarked operations
+
+
+/**
+ * @brief Measures the time per call of f. The iterations are repeated 5 times, always from the same seed,
+ * and the median is kept.
+ * @param name Name of the benchmark.
+ * @param iterations Number of calls of f in each repetition.
+ * @param f Operation to measure.
+ */
+template <class F>
+void bench(const string &name, long iterations, F f){
+  vector<double> times;
+  srand(42);
+  f();
+  for (int r=0; r < 5; r++){
+    srand(42);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (long i=0; i < iterations; i++)
+      f();
+    times.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / iterations);
+  }
+  sort(times.begin(), times.end());
+  BenchResult result = {name, iterations, times[2]};
+  results.push_back(result);
+  clog << name << ": " << times[2] << " ns" << endl;
+}
+
+
+/**
+ * @brief Reads the results of a previous run.
+ */
+map<string, double> read_baseline(const string &filename){
+  map<string, double> baseline;
+  ifstream ifs(filename);
+  string line;
+  char name[256];
+  double ns_per_op;
+  while (getline(ifs, line)){
+    size_t pos = line.find("\"ns_per_op\":");
+    if (sscanf(line.c_str(), "{\"name\":\"%255[^\"]\"", name) == 1 && pos != string::npos){
+      ns_per_op = strtod(line.c_str() + pos + 12, NULL);
+      baseline[name] = ns_per_op;
+    }
+  }
+  return baseline;
+}
+
+
+/**
+ * @brief Checks that SequenceCounter counts the expressions which it accepts like MatchCounter does with
+ * their automata, feeding both the same random chunks of every file, from a single byte to 32KB, so the
+ * sequences which cross the chunks are counted too.
+ * @return Number of counts which differ.
+ */
+int check_sequences(const vector<string> &regexs, const vector<fs::path> &files_paths){
+  SequenceCounter sequences;
+  vector<string> accepted;
+  for (size_t i=0; i < regexs.size(); i++)
+    if (sequences.add(regexs[i]))
+      accepted.push_back(regexs[i]);
+  if (accepted.empty())
+    return 0;
+  vector<Dfa> dfas;
+  vector<int> dfa_regexs;
+  build_count_dfas(accepted, 0, accepted.size(), dfas, dfa_regexs);
+  dfa_regexs.push_back(accepted.size());
+
+  int mismatches = 0;
+  mt19937 random_chunks(42);
+  vector<MatchCounter> counters(dfas.size());
+  for (size_t f=0; f < files_paths.size(); f++){
+    ifstream file(files_paths[f].string(), ifstream::binary);
+    string data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    sequences.reset();
+    for (size_t d=0; d < dfas.size(); d++)
+      counters[d].reset(dfas[d], dfa_regexs[d+1] - dfa_regexs[d]);
+    for (size_t pos=0, chunk; pos < data.size(); pos += chunk){
+      chunk = min(data.size() - pos, (size_t)1 << (random_chunks() % 15));
+      chunk = min(data.size() - pos, chunk + random_chunks() % chunk);
+      sequences.feed(data.data() + pos, chunk);
+      for (size_t d=0; d < dfas.size(); d++)
+        counters[d].feed(data.data() + pos, chunk);
+    }
+    for (size_t d=0; d < dfas.size(); d++)
+      for (int j=dfa_regexs[d]; j < dfa_regexs[d+1]; j++)
+        if (sequences.counts()[j] != counters[d].counts()[j - dfa_regexs[d]]){
+          cerr << "SequenceCounter counts " << sequences.counts()[j] << " matches of " << accepted[j] << " in "
+               << files_paths[f] << " and MatchCounter " << counters[d].counts()[j - dfa_regexs[d]] << endl;
+          mismatches++;
+        }
+  }
+  return mismatches;
+}
+
+
+/**
+ * @brief Checks that the lazy backend counts like the dfa backend with caches of a few states, which are
+ * flushed many times per file, and with the default cache.
+ * @return Number of counts which differ.
+ */
+int check_lazy(const vector<string> &regexs, const vector<fs::path> &files_paths){
+  int mismatches = 0, default_states = count_lazy_states;
+  vector<uint64_t> dfa_matches = count_matches_dfa(regexs, files_paths);
+  int states[3] = {8, 64, 1 << 14};
+  for (int s=0; s < 3; s++){
+    count_lazy_states = states[s];
+    vector<uint64_t> lazy_matches = count_matches_lazy(regexs, files_paths);
+    for (size_t i=0; i < regexs.size(); i++)
+      if (lazy_matches[i] != dfa_matches[i]){
+        cerr << "The lazy backend with " << states[s] << " states counts " << lazy_matches[i] << " matches of "
+             << regexs[i] << " and the dfa backend " << dfa_matches[i] << endl;
+        mismatches++;
+      }
+  }
+  count_lazy_states = default_states;
+  return mismatches;
+}
+
+
+/**
+ * @brief Checks that the dfa backend counts the same scanning several files at once as one by one.
+ * @return Number of counts which differ.
+ */
+int check_streams(const vector<string> &regexs, const vector<fs::path> &files_paths){
+  int mismatches = 0;
+  vector<uint64_t> single_matches = count_matches_dfa(regexs, files_paths);
+  for (int streams=4; streams <= MatchCounter::max_streams; streams *= 2){
+    count_streams = streams;
+    vector<uint64_t> stream_matches = count_matches_dfa(regexs, files_paths);
+    for (size_t i=0; i < regexs.size(); i++)
+      if (stream_matches[i] != single_matches[i]){
+        cerr << "The dfa backend with " << streams << " streams counts " << stream_matches[i] << " matches of "
+             << regexs[i] << " and with one " << single_matches[i] << endl;
+        mismatches++;
+      }
+  }
+  count_streams = 1;
+  return mismatches;
+}
+
+
+int main(int argc, char** argv){
+  string output_path, baseline_path, format;
+  double tolerance = 0.25;
+
+  if (argc == 1){
+    cout << "Insert the directory with the training files" << endl;
+    return -1;
+  }
+  fs::path examples_path = fs::system_complete(fs::path(argv[1]));
+
+  for (int i=2; i < argc;)
+    if (strcmp(argv[i], "-o") == 0 && i+1 < argc){
+      output_path = argv[i+1];
+      i+=2;
+    } else if (strcmp(argv[i], "-baseline") == 0 && i+1 < argc){
+      baseline_path = argv[i+1];
+      i+=2;
+    } else if (strcmp(argv[i], "-tolerance") == 0 && i+1 < argc){
+      tolerance = strtod(argv[i+1], NULL);
+      i+=2;
+    } else if (strcmp(argv[i], "-format") == 0 && i+1 < argc){
+      format = argv[i+1];
+      i+=2;
+    } else {
+      i++;
+    }
+
+  if (!fs::exists(examples_path)) {
+    cerr << "The specified directory doesn't exists" << endl;
+    return -1;
+  }
+  if (format.empty()){
+    vector<string> formats;
+    fs::directory_iterator end_it;
+    for(fs::directory_iterator it(examples_path); it != end_it; ++it)
+      if (fs::is_directory(it->status()))
+        formats.push_back(it->path().filename().string());
+    sort(formats.begin(), formats.end());
+    if (formats.empty()){
+      cerr << "There aren't format folders in " << examples_path << endl;
+      return -1;
+    }
+    format = formats[0];
+  }
+
+  vector<fs::path> current_format_file_paths;
+  vector<fs::path> other_formats_file_paths;
+  list_training_files(fs::path(format), examples_path, current_format_file_paths, other_formats_file_paths);
+
+  WordIndex words;
+  vector<string> word_paths;
+  for (size_t i=0; i < current_format_file_paths.size(); i++)
+    word_paths.push_back(current_format_file_paths[i].string());
+  bench("word_index", 20, [&]{ words.build(word_paths); sink += words.size(); });
+
+  // The training logs every selection in cerr
+  stringstream discarded;
+  streambuf* cerr_buffer = cerr.rdbuf(discarded.rdbuf());
+
+  const int p = 50, k = 20;
+  const double epsilon = 0.01;
+  // Every run must count the expressions again
+  count_cache = false;
+  vector<PoolRegex> initial_pool;
+  srand(42);
+  buildInitialPool(initial_pool, p);
+  vector<PoolRegex> pool = initial_pool;
+  // A couple of generations give composed expressions to the genetic operators
+  count_backend = "dfa";
+  for (int i=0; i < 2; i++){
+    complete_pool(pool, p, epsilon, words);
+    select_fittest(pool, k, current_format_file_paths, other_formats_file_paths);
+  }
+  complete_pool(pool, p, epsilon, words);
+
+  string atoms[8] = {"[a-z]", "[0-9]", "\\n", ":", "\\{", "a", "B", "="};
+  Regex regex1(atoms, 8), regex2(atoms+2, 6);
+
+  bench("regex_concat", 200000, [&]{ sink += (regex1 + regex2).length(); });
+  bench("regex_head", 200000, [&]{ sink += regex1.head(4).length(); });
+  bench("regex_tail", 200000, [&]{ sink += regex1.tail(4).length(); });
+  bench("regex_copy", 200000, [&]{ Regex copy(regex1); sink += copy.length(); });
+  RegexDag dag1(atoms, 8), dag2(atoms+2, 6);
+  bench("dag_concat", 200000, [&]{ sink += (dag1 + dag2).length(); });
+  bench("dag_head", 200000, [&]{ sink += dag1.head(4).length(); });
+  bench("dag_tail", 200000, [&]{ sink += dag1.tail(4).length(); });
+  bench("dag_copy", 200000, [&]{ RegexDag copy(dag1); sink += copy.length(); });
+  bench("crossover", 100000, [&]{ sink += crossover(pool[rand() % pool.size()], pool[rand() % pool.size()]).length(); });
+  bench("mutation", 100000, [&]{ sink += mutation(pool[rand() % pool.size()], pool).length(); });
+  bench("insert_words", 200, [&]{
+    vector<PoolRegex> inserted;
+    insertWordsFromFiles(inserted, words, 10);
+    sink += inserted.size();
+  });
+
+  bench("seed_pool", 3, [&]{
+    vector<PoolRegex> seeded;
+    seedInitialPool(seeded, p, current_format_file_paths, other_formats_file_paths);
+    sink += seeded.size();
+  });
+
+  vector<string> backends;
+  backends.push_back("dfa");
+  backends.push_back("lazy");
+  if (system("flex --version > /dev/null 2>&1") == 0)
+    backends.push_back("lex");
+  for (size_t i=0; i < backends.size(); i++){
+    count_backend = backends[i];
+    bench("count_matches_" + count_backend, 3, [&]{ sink += count_matches(pool, current_format_file_paths).size(); });
+    bench("select_fittest_" + count_backend, 3, [&]{
+      vector<PoolRegex> selected = pool;
+      select_fittest(selected, k, current_format_file_paths, other_formats_file_paths);
+      sink += selected.size();
+    });
+    bench("generation_" + count_backend, 3, [&]{
+      vector<PoolRegex> generation = initial_pool;
+      complete_pool(generation, p, epsilon, words);
+      select_fittest(generation, k, current_format_file_paths, other_formats_file_paths);
+      sink += generation.size();
+    });
+  }
+  // The lazy backend with a cache so small that it thrashes, so it steps the Nfa
+  count_backend = "lazy";
+  count_lazy_states = 8;
+  bench("count_matches_lazy_states8", 3, [&]{ sink += count_matches(pool, current_format_file_paths).size(); });
+  count_lazy_states = 1 << 14;
+  // The dfa backend scanning several files at once, a byte of each in turn
+  count_backend = "dfa";
+  for (int streams=4; streams <= MatchCounter::max_streams; streams *= 2){
+    count_streams = streams;
+    bench("count_matches_dfa_streams" + to_string(streams), 3, [&]{ sink += count_matches(pool, current_format_file_paths).size(); });
+  }
+  count_streams = 1;
+  // basic_pool alone, counted by SequenceCounter and by the automaton
+  vector<string> basic_strings = regex_strings(basic_regexs);
+  count_backend = "dfa";
+  bench("count_basic_sequences", 3, [&]{ sink += count_matches(basic_strings, current_format_file_paths).size(); });
+  count_sequences = false;
+  bench("count_basic_dfa", 3, [&]{ sink += count_matches(basic_strings, current_format_file_paths).size(); });
+  count_sequences = true;
+  cerr.rdbuf(cerr_buffer);
+
+  // The faster counters must give the counts of the automata
+  vector<string> check_regexs = regex_strings(pool);
+  check_regexs.insert(check_regexs.end(), basic_strings.begin(), basic_strings.end());
+  vector<fs::path> check_paths = current_format_file_paths;
+  check_paths.insert(check_paths.end(), other_formats_file_paths.begin(), other_formats_file_paths.end());
+  int mismatches = check_sequences(check_regexs, check_paths) + check_lazy(check_regexs, check_paths)
+                   + check_streams(check_regexs, check_paths);
+
+  stringstream json;
+  char number[32];
+  json << "{\"benchmarks\":[" << endl;
+  for (size_t i=0; i < results.size(); i++){
+    snprintf(number, sizeof(number), "%.1f", results[i].ns_per_op);
+    json << "{\"name\":\"" << results[i].name << "\",\"iterations\":" << results[i].iterations << ",\"ns_per_op\":" << number << "}" << (i+1 < results.size() ? "," : "") << endl;
+  }
+  json << "]}" << endl;
+  if (output_path.empty())
+    cout << json.str();
+  else
+    ofstream(output_path) << json.str();
+
+  int regressions = 0;
+  if (!baseline_path.empty()){
+    map<string, double> baseline = read_baseline(baseline_path);
+    for (size_t i=0; i < results.size(); i++){
+      map<string, double>::iterator it = baseline.find(results[i].name);
+      if (it != baseline.end() && results[i].ns_per_op > it->second * (1 + tolerance)){
+        cerr << "Regression in " << results[i].name << ": " << results[i].ns_per_op << " ns (baseline " << it->second << " ns)" << endl;
+        regressions++;
+      }
+    }
+  }
+  return regressions > 0 || mismatches > 0 ? 1 : 0;
+}
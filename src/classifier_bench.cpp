@@ -0,0 +1,451 @@
+#include <chrono>
+#include <algorithm>
+#include <sstream>
+#include <random>
+#include "training.hpp"
+#include "classifier.hpp"
+
+
+/**
+ * @brief Times of a classifier backend over the inputs of one size.
+ */
+struct BackendResult{
+  string backend;
+  double startup_us;
+  double mb_per_s;
+  vector<double> latencies_us;
+  int mismatches;  // Reliabilities which differ from the library without prestage
+  int pruned;      // Formats discarded by the prestage
+};
+
+
+/**
+ * @brief Inputs of one size and kind: samples of the training formats, random bytes, which the prestage
+ * should discard, or slices of every format in turn, which no format explains alone.
+ */
+struct InputSet{
+  uint64_t size;
+  string kind;
+  vector<string> data;
+  vector<string> paths;
+};
+
+volatile double sink; // Keeps the compiler from removing the classifications
+
+
+/**
+ * @brief Reads a comma separated list of sizes with optional K, M or G suffixes.
+ */
+vector<uint64_t> parse_list(const char* str){
+  vector<uint64_t> values;
+  while (*str != '\0'){
+    char* end;
+    double value = strtod(str, &end);
+    if (*end == 'k' || *end == 'K') value *= 1ULL << 10, end++;
+    else if (*end == 'm' || *end == 'M') value *= 1ULL << 20, end++;
+    else if (*end == 'g' || *end == 'G') value *= 1ULL << 30, end++;
+    if (end == str)
+      break;
+    values.push_back((uint64_t)value);
+    str = *end == ',' ? end+1 : end;
+  }
+  return values;
+}
+
+
+double seconds_since(const chrono::steady_clock::time_point &start){
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+
+double percentile(vector<double> values, double p){
+  if (values.empty())
+    return 0;
+  sort(values.begin(), values.end());
+  return values[min(values.size()-1, (size_t)(p * values.size()))];
+}
+
+
+string read_file(const fs::path &path){
+  ifstream ifs(path.string(), ios::binary);
+  return string(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+}
+
+
+/**
+ * @brief Builds the expressions of a model of controlled size: the k_0 n-grams, patterns and words of best
+ * goodness of each format against the other formats of the model, which the training uses as seeds.
+ */
+void build_model(const vector<string> &formats, const fs::path &examples_path, int k_0, OutputTemplate &output_template, Prestage &prestage){
+  vector<vector<string> > paths(formats.size());
+  fs::directory_iterator end_it;
+  for (size_t i=0; i < formats.size(); i++){
+    for (fs::directory_iterator it(examples_path/formats[i]); it != end_it; ++it)
+      if (fs::is_regular_file(it->status()))
+        paths[i].push_back(it->path().string());
+    sort(paths[i].begin(), paths[i].end());
+  }
+  for (size_t i=0; i < formats.size(); i++){
+    NgramStats stats;
+    vector<string> other_paths;
+    for (size_t j=0; j < formats.size(); j++)
+      if (j != i)
+        other_paths.insert(other_paths.end(), paths[j].begin(), paths[j].end());
+    stats.build(paths[i], other_paths, thread::hardware_concurrency());
+    vector<NgramStats::Candidate> candidates = stats.best(k_0);
+    for (size_t j=0; j < candidates.size(); j++){
+      string regex;
+      for (size_t a=0; a < candidates[j].atoms.size(); a++)
+        regex += candidates[j].atoms[a];
+      output_template.addRegex(formats[i], regex, candidates[j].goodness);
+    }
+    train_prestage(prestage, fs::path(formats[i]), examples_path);
+  }
+}
+
+
+/**
+ * @brief Times a classifier of the library over every input and compares its reliabilities with the reference.
+ * @param classify Classifies an input, writing the reliabilities.
+ */
+template <class F>
+BackendResult bench_library(const string &name, double startup_us, const vector<string> &inputs, int formats, const vector<vector<double> > &reference, F classify){
+  BackendResult result = {name, startup_us, 0, vector<double>(), 0, 0};
+  vector<double> reliabilities(formats);
+  double total = 0, bytes = 0;
+  for (size_t i=0; i < inputs.size(); i++){
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    classify(inputs[i], &reliabilities[0]);
+    double elapsed = seconds_since(start);
+    total += elapsed;
+    bytes += inputs[i].size();
+    result.latencies_us.push_back(elapsed * 1e6);
+    for (int f=0; f < formats; f++){
+      sink += reliabilities[f];
+      // The prestage may only give 0 to the formats which it discards
+      if (reference.size() > i && reliabilities[f] != reference[i][f] && !(reliabilities[f] == 0 && name == "prestage"))
+        result.mismatches++;
+    }
+  }
+  result.mb_per_s = total > 0 ? bytes / total / (1 << 20) : 0;
+  return result;
+}
+
+
+/**
+ * @brief Times Classifier::classifyBatch over all the inputs at once, scanning streams of them at a time,
+ * and compares its reliabilities with the reference. Each latency is the time of the batch divided among its
+ * inputs.
+ */
+BackendResult bench_batch(const Classifier &classifier, int streams, double startup_us, const vector<string> &inputs, const vector<vector<double> > &reference){
+  BackendResult result = {"streams" + to_string(streams), startup_us, 0, vector<double>(), 0, 0};
+  int formats = classifier.formats();
+  vector<const char*> data;
+  vector<size_t> lengths;
+  double bytes = 0;
+  for (size_t i=0; i < inputs.size(); i++){
+    data.push_back(inputs[i].data());
+    lengths.push_back(inputs[i].size());
+    bytes += inputs[i].size();
+  }
+  vector<double> reliabilities(inputs.size() * formats);
+  vector<double> times;
+  for (int r=0; r < 5; r++){
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    classifier.classifyBatch(&data[0], &lengths[0], inputs.size(), &reliabilities[0], streams);
+    times.push_back(seconds_since(start));
+  }
+  double total = percentile(times, 0.5);
+  result.latencies_us.assign(inputs.size(), total * 1e6 / inputs.size());
+  result.mb_per_s = total > 0 ? bytes / total / (1 << 20) : 0;
+  for (size_t i=0; i < inputs.size(); i++)
+    for (int f=0; f < formats; f++){
+      sink += reliabilities[i*formats + f];
+      if (reference.size() > i && reliabilities[i*formats + f] != reference[i][f])
+        result.mismatches++;
+    }
+  return result;
+}
+
+
+/**
+ * @brief Runs a generated classifier once per input, reading the reliabilities it prints, and once in batch
+ * mode over all of them for the throughput. Its latencies include starting the process.
+ */
+BackendResult bench_program(const string &name, const string &program, const vector<string> &input_paths, const vector<string> &inputs, const vector<vector<double> > &reference){
+  BackendResult result = {name, 0, 0, vector<double>(), 0, 0};
+  string output_path = program + ".out";
+  double bytes = 0;
+
+  vector<double> startups;
+  for (int r=0; r < 5; r++){
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    system((program + " /dev/null > " + output_path).c_str());
+    startups.push_back(seconds_since(start) * 1e6);
+  }
+  result.startup_us = percentile(startups, 0.5);
+
+  for (size_t i=0; i < input_paths.size(); i++){
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    system((program + " " + input_paths[i] + " > " + output_path).c_str());
+    result.latencies_us.push_back(seconds_since(start) * 1e6);
+    bytes += inputs[i].size();
+
+    // The reliabilities are printed with 6 decimals
+    ifstream ifs(output_path);
+    string line;
+    size_t f = 0;
+    while (getline(ifs, line)){
+      size_t pos = line.rfind(' ');
+      if (pos == string::npos || f >= reference[i].size())
+        continue;
+      if (fabs(strtod(line.c_str() + pos + 1, NULL) - reference[i][f]) > 5e-7)
+        result.mismatches++;
+      f++;
+    }
+    if (f != reference[i].size())
+      result.mismatches++;
+  }
+
+  string command = program + " -batch -threads 1";
+  for (size_t i=0; i < input_paths.size(); i++)
+    command += " " + input_paths[i];
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  system((command + " > " + output_path).c_str());
+  double total = seconds_since(start);
+  result.mb_per_s = total > 0 ? bytes / total / (1 << 20) : 0;
+  return result;
+}
+
+
+int main(int argc, char** argv){
+  string output_path;
+  vector<uint64_t> k_0_list(1, 1), formats_list, sizes;
+  int files_num = 20;
+  bool generated = true;
+
+  if (argc == 1){
+    cout << "Usage: classifier_bench <training_dir> [-k_0 n,...] [-formats n,...] [-sizes bytes[K|M|G],...]"
+         << " [-files n] [-no-generated] [-o file]" << endl;
+    return -1;
+  }
+  fs::path examples_path = fs::system_complete(fs::path(argv[1]));
+  k_0_list.push_back(5);
+  k_0_list.push_back(10);
+  sizes.push_back(4 << 10);
+  sizes.push_back(1 << 20);
+
+  for (int i=2; i < argc;)
+    if (strcmp(argv[i], "-k_0") == 0 && i+1 < argc){
+      k_0_list = parse_list(argv[i+1]);
+      i+=2;
+    } else if (strcmp(argv[i], "-formats") == 0 && i+1 < argc){
+      formats_list = parse_list(argv[i+1]);
+      i+=2;
+    } else if (strcmp(argv[i], "-sizes") == 0 && i+1 < argc){
+      sizes = parse_list(argv[i+1]);
+      i+=2;
+    } else if (strcmp(argv[i], "-files") == 0 && i+1 < argc){
+      files_num = atoi(argv[i+1]);
+      i+=2;
+    } else if (strcmp(argv[i], "-no-generated") == 0){
+      generated = false;
+      i++;
+    } else if (strcmp(argv[i], "-o") == 0 && i+1 < argc){
+      output_path = argv[i+1];
+      i+=2;
+    } else {
+      i++;
+    }
+
+  if (!fs::exists(examples_path)) {
+    cerr << "The specified directory doesn't exists" << endl;
+    return -1;
+  }
+  vector<string> formats;
+  vector<fs::path> sample_paths;
+  vector<vector<fs::path> > format_samples;
+  fs::directory_iterator end_it;
+  for (fs::directory_iterator it(examples_path); it != end_it; ++it)
+    if (fs::is_directory(it->status()))
+      formats.push_back(it->path().filename().string());
+  sort(formats.begin(), formats.end());
+  for (size_t i=0; i < formats.size(); i++){
+    format_samples.push_back(vector<fs::path>());
+    for (fs::directory_iterator it(examples_path/formats[i]); it != end_it; ++it)
+      if (fs::is_regular_file(it->status()))
+        format_samples[i].push_back(it->path());
+    sort(format_samples[i].begin(), format_samples[i].end());
+    sample_paths.insert(sample_paths.end(), format_samples[i].begin(), format_samples[i].end());
+  }
+  sort(sample_paths.begin(), sample_paths.end());
+  if (formats.empty() || sample_paths.empty() || files_num <= 0){
+    cerr << "There aren't training files in " << examples_path << endl;
+    return -1;
+  }
+  if (formats_list.empty()){
+    formats_list.push_back(1);
+    if (formats.size() > 1)
+      formats_list.push_back(formats.size());
+  }
+
+  fs::path work_path = fs::temp_directory_path() / fs::unique_path("fguess-bench-%%%%%%%%");
+  fs::create_directories(work_path);
+
+  // Inputs of each size: the samples of every format in turn, repeated until the size is reached, random
+  // bytes with a fixed seed, and 1KB slices of a sample of each format in turn
+  vector<InputSet> inputs;
+  mt19937 random_bytes(1);
+  for (size_t s=0; s < sizes.size(); s++){
+    const char* kinds[] = {"samples", "binary", "mixed"};
+    for (int k=0; k < 3; k++){
+      InputSet set = {sizes[s], kinds[k], vector<string>(), vector<string>()};
+      for (int i=0; i < files_num; i++){
+        string input;
+        if (set.kind == "samples"){
+          string sample = read_file(sample_paths[i % sample_paths.size()]);
+          while (!sample.empty() && input.size() < sizes[s])
+            input += sample.substr(0, sizes[s] - input.size());
+        } else if (set.kind == "binary"){
+          input.resize(sizes[s]);
+          for (size_t b=0; b < input.size(); b++)
+            input[b] = (char)(random_bytes() & 0xff);
+        } else {
+          vector<string> samples;
+          for (size_t f=0; f < format_samples.size(); f++)
+            if (!format_samples[f].empty())
+              samples.push_back(read_file(format_samples[f][i % format_samples[f].size()]));
+          vector<size_t> offsets(samples.size(), 0);
+          bool grown = true;
+          while (grown && input.size() < sizes[s]){
+            grown = false;
+            for (size_t f=0; f < samples.size() && input.size() < sizes[s]; f++){
+              if (samples[f].empty())
+                continue;
+              if (offsets[f] >= samples[f].size())
+                offsets[f] = 0;
+              string slice = samples[f].substr(offsets[f], min<uint64_t>(1 << 10, sizes[s] - input.size()));
+              offsets[f] += slice.size();
+              input += slice;
+              grown = true;
+            }
+          }
+        }
+        set.data.push_back(input);
+        set.paths.push_back((work_path / ("input_" + set.kind + "_" + to_string(sizes[s]) + "_" + to_string(i))).string());
+        ofstream(set.paths.back(), ios::binary) << input;
+      }
+      inputs.push_back(set);
+    }
+  }
+
+  vector<string> programs;
+  if (generated && system("gcc --version > /dev/null 2>&1") == 0)
+    programs.push_back("generated");
+  if (generated && system("flex --version > /dev/null 2>&1") == 0)
+    programs.push_back("lex");
+
+  stringstream json;
+  int mismatches = 0;
+  for (size_t fi=0; fi < formats_list.size(); fi++)
+    for (size_t ki=0; ki < k_0_list.size(); ki++){
+      int formats_num = min((size_t)formats_list[fi], formats.size());
+      int k_0 = k_0_list[ki];
+      vector<string> model_formats(formats.begin(), formats.begin() + formats_num);
+      string model_name = "f" + to_string(formats_num) + "_k" + to_string(k_0);
+      string model_path = (work_path / (model_name + ".model")).string();
+
+      OutputTemplate output_template;
+      Prestage prestage;
+      build_model(model_formats, examples_path, k_0, output_template, prestage);
+      ModelTemplate(output_template, &prestage).save(model_path);
+
+      vector<double> startups;
+      Classifier classifier, prestage_classifier;
+      for (int r=0; r < 5; r++){
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        Classifier loaded;
+        if (!loaded.load(model_path)){
+          cerr << "The model " << model_name << " can't be loaded" << endl;
+          return -1;
+        }
+        startups.push_back(seconds_since(start) * 1e6);
+      }
+      classifier.load(model_path);
+      classifier.usePrestage(false);
+      prestage_classifier.load(model_path);
+      ClassifierSession session(classifier);
+      double startup_us = percentile(startups, 0.5);
+
+      map<string, string> program_paths;
+      for (size_t p=0; p < programs.size(); p++){
+        string program = (work_path / (model_name + "_" + programs[p])).string();
+        string command;
+        if (programs[p] == "generated"){
+          DfaOutputTemplate(output_template).save(program + ".c");
+          command = "gcc -O2 " + program + ".c -o " + program + " -lpthread";
+        } else {
+          output_template.save(program + ".lex");
+          command = "flex -o " + program + ".yy.c " + program + ".lex && gcc " + program + ".yy.c -o " + program + " -lpthread";
+        }
+        if (system((command + " > /dev/null 2>&1").c_str()) == 0)
+          program_paths[programs[p]] = program;
+        else
+          cerr << "The " << programs[p] << " classifier of " << model_name << " can't be compiled" << endl;
+      }
+
+      for (size_t s=0; s < inputs.size(); s++){
+        vector<BackendResult> results;
+        vector<vector<double> > reference;
+        results.push_back(bench_library("library", startup_us, inputs[s].data, formats_num, reference, [&](const string &data, double* reliabilities){
+          classifier.classify(data, reliabilities);
+          reference.push_back(vector<double>(reliabilities, reliabilities + formats_num));
+        }));
+        results.push_back(bench_library("prestage", startup_us, inputs[s].data, formats_num, reference, [&](const string &data, double* reliabilities){
+          prestage_classifier.classify(data, reliabilities);
+        }));
+        // The discarded formats are counted out of the timing, from the prestage of the model
+        vector<char> keep;
+        for (size_t i=0; i < inputs[s].data.size(); i++){
+          prestage.candidates(inputs[s].data[i].data(), inputs[s].data[i].size(), keep);
+          results.back().pruned += count(keep.begin(), keep.end(), 0);
+        }
+        results.push_back(bench_library("stream", startup_us, inputs[s].data, formats_num, reference, [&](const string &data, double* reliabilities){
+          const size_t chunk = 64 << 10;
+          session.reset();
+          for (size_t pos=0; pos < data.size(); pos += chunk)
+            session.feed(data.data() + pos, min(chunk, data.size() - pos));
+          session.reliabilities(reliabilities);
+        }));
+        for (int streams=4; streams <= MatchCounter::max_streams; streams *= 2)
+          results.push_back(bench_batch(classifier, streams, startup_us, inputs[s].data, reference));
+        for (map<string, string>::iterator it = program_paths.begin(); it != program_paths.end(); ++it)
+          results.push_back(bench_program(it->first, it->second, inputs[s].paths, inputs[s].data, reference));
+
+        for (size_t r=0; r < results.size(); r++){
+          char numbers[256];
+          snprintf(numbers, sizeof(numbers), "\"startup_us\":%.1f,\"mb_per_s\":%.2f,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f",
+                   results[r].startup_us, results[r].mb_per_s, percentile(results[r].latencies_us, 0.5),
+                   percentile(results[r].latencies_us, 0.9), percentile(results[r].latencies_us, 0.99));
+          json << "{\"model\":\"" << model_name << "\",\"formats\":" << formats_num << ",\"k_0\":" << k_0
+               << ",\"regexs\":" << classifier.model().regexsNum() << ",\"dfa_states\":" << classifier.dfa().states() << ",\"table_bytes\":" << classifier.dfa().tableBytes()
+               << ",\"backend\":\"" << results[r].backend << "\",\"inputs\":\"" << inputs[s].kind << "\",\"input_size\":" << inputs[s].size
+               << ",\"files\":" << inputs[s].data.size() << "," << numbers << ",\"identical\":" << (results[r].mismatches == 0 ? "true" : "false")
+               << ",\"pruned\":" << results[r].pruned << "}" << endl;
+          clog << model_name << " " << results[r].backend << " " << inputs[s].kind << " " << inputs[s].size << " bytes: "
+               << results[r].mb_per_s << " MB/s" << endl;
+          if (results[r].mismatches > 0)
+            cerr << "The " << results[r].backend << " reliabilities of " << model_name << " differ from the library in "
+                 << results[r].mismatches << " values" << endl;
+          mismatches += results[r].mismatches;
+        }
+      }
+    }
+  fs::remove_all(work_path);
+
+  if (output_path.empty())
+    cout << json.str();
+  else
+    ofstream(output_path) << json.str();
+  return mismatches > 0 ? 1 : 0;
+}
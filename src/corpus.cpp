@@ -0,0 +1,150 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <boost/filesystem.hpp>
+#include "corpus.hpp"
+using namespace std;
+namespace fs = boost::filesystem;
+
+
+/**
+ * @brief Reads a size in bytes with an optional K, M or G suffix.
+ */
+uint64_t parse_size(const char* str){
+  char* end;
+  double size = strtod(str, &end);
+  if (*end == 'k' || *end == 'K') size *= 1ULL << 10;
+  else if (*end == 'm' || *end == 'M') size *= 1ULL << 20;
+  else if (*end == 'g' || *end == 'G') size *= 1ULL << 30;
+  return (uint64_t)size;
+}
+
+
+int main(int argc, char** argv){
+  uint64_t total_size = 64ULL << 20;
+  int files_num = 10, formats_num = 0, run_length = 64;
+  unsigned long seed = 42;
+  string distribution = "lognormal";
+
+  if (argc < 3){
+    cout << "Usage: corpus <training_dir> <output_dir> [-size bytes[K|M|G]] [-files n] [-formats n]"
+         << " [-distribution fixed|uniform|lognormal] [-run bytes] [-seed n]" << endl;
+    return -1;
+  }
+  fs::path examples_path = fs::system_complete(fs::path(argv[1]));
+  fs::path output_path = fs::system_complete(fs::path(argv[2]));
+
+  for (int i=3; i < argc;)
+    if (strcmp(argv[i], "-size") == 0 && i+1 < argc){
+      total_size = parse_size(argv[i+1]);
+      i+=2;
+    } else if (strcmp(argv[i], "-files") == 0 && i+1 < argc){
+      files_num = atoi(argv[i+1]);
+      i+=2;
+    } else if (strcmp(argv[i], "-formats") == 0 && i+1 < argc){
+      formats_num = atoi(argv[i+1]);
+      i+=2;
+    } else if (strcmp(argv[i], "-distribution") == 0 && i+1 < argc){
+      distribution = argv[i+1];
+      i+=2;
+    } else if (strcmp(argv[i], "-run") == 0 && i+1 < argc){
+      run_length = atoi(argv[i+1]);
+      i+=2;
+    } else if (strcmp(argv[i], "-seed") == 0 && i+1 < argc){
+      seed = strtoul(argv[i+1], NULL, 10);
+      i+=2;
+    } else {
+      i++;
+    }
+
+  if (!fs::exists(examples_path)) {
+    cerr << "The specified directory doesn't exists" << endl;
+    return -1;
+  }
+  if (files_num < 1 || run_length < 1){
+    cerr << "The number of files and the run length must be positive" << endl;
+    return -1;
+  }
+
+  // Sample formats, sorted so the same seed always gives the same corpus
+  vector<fs::path> sample_folders;
+  fs::directory_iterator end_it;
+  for(fs::directory_iterator it(examples_path); it != end_it; ++it)
+    if (fs::is_directory(it->status()))
+      sample_folders.push_back(it->path());
+  sort(sample_folders.begin(), sample_folders.end());
+
+  vector<TextModel> models;
+  vector<string> names, extensions;
+  for (size_t i=0; i < sample_folders.size(); i++){
+    vector<fs::path> samples;
+    for (fs::directory_iterator it(sample_folders[i]); it != end_it; ++it)
+      if (fs::is_regular_file(it->status()))
+        samples.push_back(it->path());
+    sort(samples.begin(), samples.end());
+    models.push_back(TextModel());
+    for (size_t j=0; j < samples.size(); j++){
+      ifstream ifs(samples[j].string());
+      stringstream data;
+      data << ifs.rdbuf();
+      models.back().addSample(data.str());
+    }
+    if (models.back().empty()){
+      models.pop_back();
+      continue;
+    }
+    models.back().build();
+    names.push_back(sample_folders[i].filename().string());
+    extensions.push_back(samples[0].extension().string());
+  }
+  if (models.empty()){
+    cerr << "There aren't sample files in " << examples_path << endl;
+    return -1;
+  }
+  if (formats_num <= 0)
+    formats_num = models.size();
+
+  SizeDistribution sizes(distribution, (double)total_size / ((double)files_num * formats_num));
+  if (!sizes.valid()){
+    cerr << "Unknown distribution " << distribution << endl;
+    return -1;
+  }
+
+  // Formats beyond the samples reuse them with their letters rotated
+  mt19937_64 rng(seed);
+  vector<char> buffer(1 << 20);
+  uint64_t written = 0;
+  for (int i=0; i < formats_num; i++){
+    int base = i % models.size(), rotation = i / models.size();
+    string name = names[base] + (rotation > 0 ? "_" + to_string(rotation) : "");
+    fs::path folder = output_path / name;
+    uint64_t format_bytes = 0;
+    fs::create_directories(folder);
+    models[base].setRotation(rotation);
+    for (int j=0; j < files_num; j++){
+      fs::path file_path = folder / (to_string(j) + extensions[base]);
+      uint64_t size = sizes.sample(rng);
+      FILE* out = fopen(file_path.string().c_str(), "wb");
+      if (out == NULL){
+        cerr << "The file " << file_path << " can't be created" << endl;
+        return -1;
+      }
+      setvbuf(out, &buffer[0], _IOFBF, buffer.size());
+      bool ok = models[base].generate(out, size, rng, run_length);
+      if (fclose(out) != 0 || !ok){
+        cerr << "The file " << file_path << " can't be written" << endl;
+        return -1;
+      }
+      format_bytes += size;
+    }
+    cout << name << " [" << files_num << " files, " << format_bytes << " bytes]" << endl;
+    written += format_bytes;
+  }
+  cout << "Written " << written << " bytes in " << output_path << endl;
+  return 0;
+}
@@ -0,0 +1,124 @@
+#include <mutex>
+#include <thread>
+#include <signal.h>
+#include "training.hpp"
+
+
+fs::path root_path;
+mutex count_mutex; // The counting backends and their cache are shared by all the connections
+
+
+/**
+ * @brief Whether a path sent by a client is relative and stays under the root directory, so the clients
+ * can't count the matches of any file which the worker can read.
+ */
+bool safe_path(const string &line){
+  fs::path path(line);
+  if (line.empty() || path.has_root_path())
+    return false;
+  for (fs::path::iterator it = path.begin(); it != path.end(); ++it)
+    if (it->string() == "..")
+      return false;
+  return true;
+}
+
+
+/**
+ * @brief Serves the requests of a training process. Every request is a line
+ *   COUNT <regexs> <files>
+ * followed by a line with each expression and a line with the path of each file, relative to the root
+ * directory of the worker, which can't be absolute or contain "..". It's answered with a line with the bytes
+ * of the files and the matches of each expression in all of them, separated by spaces, or with a line
+ * ERROR <reason>. The training takes the bytes of the files from there, so it never has to read them.
+ */
+void serve(int fd){
+  LineChannel channel(fd);
+  string line;
+  while (channel.readLine(line)){
+    int regexs_num, files_num;
+    if (sscanf(line.c_str(), "COUNT %d %d", &regexs_num, &files_num) != 2 || regexs_num < 0 || files_num < 0){
+      channel.write("ERROR unknown request\n");
+      return;
+    }
+    vector<string> regexs;
+    vector<fs::path> files_paths;
+    string missing, unsafe;
+    for (int i=0; i < regexs_num && channel.readLine(line); i++)
+      regexs.push_back(line);
+    for (int i=0; i < files_num && channel.readLine(line); i++){
+      files_paths.push_back(root_path / line);
+      if (!safe_path(line))
+        unsafe = line;
+      else if (!fs::is_regular_file(files_paths.back()))
+        missing = line;
+    }
+    if (regexs.size() < regexs_num || files_paths.size() < files_num)
+      return;
+    if (!unsafe.empty()){
+      channel.write("ERROR " + unsafe + " is outside the directory\n");
+      continue;
+    }
+    if (!missing.empty()){
+      channel.write("ERROR " + missing + " can't be read\n");
+      continue;
+    }
+
+    vector<uint64_t> matches;
+    {
+      lock_guard<mutex> lock(count_mutex);
+      matches = count_matches(regexs, files_paths);
+    }
+    uint64_t bytes = 0;
+    for (vector<fs::path>::const_iterator it = files_paths.begin(); it != files_paths.end(); ++it)
+      bytes += fs::file_size(*it);
+    string answer = to_string(bytes);
+    for (int i=0; i < matches.size(); i++)
+      answer += " " + to_string(matches[i]);
+    if (!channel.write(answer + "\n"))
+      return;
+  }
+}
+
+
+int main(int argc, char** argv){
+  string address = "unix:count_worker.sock";
+
+  if (argc == 1){
+    cout << "Insert the directory with the training files" << endl;
+    return -1;
+  }
+  root_path = fs::system_complete(fs::path(argv[1]));
+  count_backend = "dfa";
+
+  for (int i=2; i < argc;)
+    if (strcmp(argv[i], "-listen") == 0 && i+1 < argc){
+      address = argv[i+1];
+      i+=2;
+    } else if (strcmp(argv[i], "-backend") == 0 && i+1 < argc){
+      count_backend = argv[i+1];
+      i+=2;
+    } else if (strcmp(argv[i], "-lazy-states") == 0 && i+1 < argc){
+      count_lazy_states = atoi(argv[i+1]);
+      i+=2;
+    } else {
+      i++;
+    }
+
+  if (!fs::is_directory(root_path)){
+    cerr << "The specified directory doesn't exists" << endl;
+    return -1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  int server = openSocket(address, true);
+  if (server < 0){
+    cerr << "The socket " << address << " can't be created" << endl;
+    return -1;
+  }
+  cout << "Listening on " << address << endl;
+
+  int client;
+  while ((client = accept(server, NULL, NULL)) >= 0)
+    thread(serve, client).detach();
+
+  return 0;
+}
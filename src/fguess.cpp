@@ -0,0 +1,76 @@
+#include "classifier.hpp"
+#include "fguess.h"
+
+
+struct fguess_model{
+  Classifier classifier;
+};
+
+
+struct fguess_stream{
+  const fguess_model* model;
+  ClassifierSession session;
+
+  fguess_stream(const fguess_model* model) : model(model), session(model->classifier){}
+};
+
+
+fguess_model* fguess_model_load(const char* path){
+  fguess_model* model = new fguess_model;
+  if (!model->classifier.load(path)){
+    delete model;
+    return NULL;
+  }
+  return model;
+}
+
+
+void fguess_model_free(fguess_model* model){
+  delete model;
+}
+
+
+int fguess_formats_num(const fguess_model* model){
+  return model->classifier.formats();
+}
+
+
+const char* fguess_format_name(const fguess_model* model, int i){
+  return model->classifier.formatName(i).c_str();
+}
+
+
+void fguess_model_prestage(fguess_model* model, int enabled){
+  model->classifier.usePrestage(enabled != 0);
+}
+
+
+int fguess_classify(const fguess_model* model, const void* data, size_t length, double* reliabilities, int reliabilities_num){
+  if (reliabilities_num < model->classifier.formats())
+    return -1;
+  model->classifier.classify((const char*)data, length, reliabilities);
+  return model->classifier.formats();
+}
+
+
+fguess_stream* fguess_stream_new(const fguess_model* model){
+  return new fguess_stream(model);
+}
+
+
+void fguess_stream_free(fguess_stream* stream){
+  delete stream;
+}
+
+
+void fguess_stream_feed(fguess_stream* stream, const void* data, size_t length){
+  stream->session.feed((const char*)data, length);
+}
+
+
+int fguess_stream_reliabilities(const fguess_stream* stream, double* reliabilities, int reliabilities_num){
+  if (reliabilities_num < stream->model->classifier.formats())
+    return -1;
+  stream->session.reliabilities(reliabilities);
+  return stream->model->classifier.formats();
+}
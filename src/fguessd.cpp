@@ -0,0 +1,329 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "classifier.hpp"
+using namespace std;
+
+
+/**
+ * @brief Latency histogram with a bucket for each power of two of microseconds.
+ */
+class LatencyHistogram{
+private:
+  static const int buckets_num = 32;
+  atomic<uint64_t> m_buckets[buckets_num];
+  atomic<uint64_t> m_count;
+  atomic<uint64_t> m_total_us;
+
+public:
+
+  LatencyHistogram(){
+    for (int i=0; i < buckets_num; i++)
+      m_buckets[i] = 0;
+    m_count = 0;
+    m_total_us = 0;
+  }
+
+  /**
+   * @brief Records a latency.
+   */
+  void add(uint64_t us){
+    int bucket = 0;
+    while (bucket < buckets_num-1 && (1ULL << bucket) < us)
+      bucket++;
+    m_buckets[bucket]++;
+    m_count++;
+    m_total_us += us;
+  }
+
+  /**
+   * @brief Returns the histogram as a JSON object whose keys are the upper bound of each bucket in microseconds.
+   */
+  string toString() const{
+    string str = "{\"count\":" + to_string(m_count.load()) + ",\"total_us\":" + to_string(m_total_us.load()) + ",\"buckets\":{";
+    bool first = true;
+    for (int i=0; i < buckets_num; i++)
+      if (m_buckets[i] > 0){
+        if (!first) str += ",";
+        str += "\"" + to_string(1ULL << i) + "\":" + to_string(m_buckets[i].load());
+        first = false;
+      }
+    return str + "}}";
+  }
+};
+
+
+shared_ptr<const Classifier> classifier; // Only accessed with atomic_load and atomic_store
+string model_path;
+mutex reload_mutex;
+atomic<uint64_t> reloads(0);
+LatencyHistogram classify_latency, data_latency;
+
+
+/**
+ * @brief Loads the model again (or a new one) and replaces the current classifier. Requests in progress
+ * keep the classifier they started with.
+ * @param path Path of the new model. If it's empty the last model path is used.
+ */
+bool reload(const string &path){
+  lock_guard<mutex> lock(reload_mutex);
+  string new_path = path.empty() ? model_path : path;
+  shared_ptr<Classifier> new_classifier(new Classifier);
+  if (!new_classifier->load(new_path))
+    return false;
+  atomic_store(&classifier, shared_ptr<const Classifier>(new_classifier));
+  model_path = new_path;
+  reloads++;
+  return true;
+}
+
+
+string jsonString(const string &str){
+  string json = "\"";
+  char code[8];
+  for (size_t i=0; i < str.size(); i++){
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\'){
+      json += '\\';
+      json += c;
+    } else if (c < 0x20){
+      snprintf(code, sizeof(code), "\\u%04x", c);
+      json += code;
+    } else json += c;
+  }
+  return json + "\"";
+}
+
+
+/**
+ * @brief Returns the JSON result of a classification, like the lines of fguess -batch.
+ */
+string resultString(const Classifier &model, const ClassifierSession &session, const string &path){
+  vector<double> rel(model.formats());
+  char number[32];
+  int best = 0;
+  session.reliabilities(rel.data());
+  for (int i=0; i < model.formats(); i++)
+    if (rel[i] > rel[best]) best = i;
+  string str = "{";
+  if (!path.empty())
+    str += "\"path\":" + jsonString(path) + ",";
+  str += "\"bytes\":" + to_string(session.bytes()) + ",\"format\":" + jsonString(model.formats() > 0 ? model.formatName(best) : "") + ",\"reliability\":{";
+  for (int i=0; i < model.formats(); i++){
+    snprintf(number, sizeof(number), "%lf", rel[i]);
+    str += (i > 0 ? "," : "") + jsonString(model.formatName(i)) + ":" + number;
+  }
+  return str + "}}\n";
+}
+
+
+// Longest request line. A longer one is answered with an error and discarded up to its end
+const size_t max_line_length = 1 << 16;
+
+
+uint64_t elapsedUs(const chrono::steady_clock::time_point &start){
+  return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+}
+
+
+/**
+ * @brief Serves the requests of a client. Every request is a line:
+ *   CLASSIFY <path>   Classifies a file.
+ *   DATA <length>     Classifies the <length> bytes which follow the line.
+ *   STATS             Returns the number of reloads and the latency histograms.
+ *   RELOAD [<path>]   Replaces the model by a new one (by default the same file loaded again).
+ * Each request is answered with a JSON line, in order. Lines longer than max_line_length are answered with
+ * an error and skipped. All the requests received in the same read are
+ * served before writing their answers at once, so pipelined clients get their answers in batches.
+ */
+void serve(int fd){
+  vector<char> buffer(1 << 16);
+  string in, out;
+  shared_ptr<const Classifier> model;
+  unique_ptr<ClassifierSession> session;
+  uint64_t data_left = 0;
+  bool discarding = false; // Whether the rest of a too long line is being skipped
+  chrono::steady_clock::time_point data_start;
+  ssize_t n;
+
+  while ((n = read(fd, &buffer[0], buffer.size())) > 0){
+    in.append(&buffer[0], n);
+    size_t pos = 0;
+    while (pos < in.size()){
+      if (discarding){
+        size_t end = in.find('\n', pos);
+        pos = end == string::npos ? in.size() : end + 1;
+        discarding = end == string::npos;
+        continue;
+      }
+      if (data_left > 0){
+        size_t length = min<uint64_t>(data_left, in.size() - pos);
+        session->feed(in.data() + pos, length);
+        pos += length;
+        data_left -= length;
+        if (data_left == 0){
+          out += resultString(*model, *session, "");
+          data_latency.add(elapsedUs(data_start));
+        }
+        continue;
+      }
+
+      size_t end = in.find('\n', pos);
+      if (end == string::npos)
+        break;
+      string line = in.substr(pos, end - pos);
+      pos = end + 1;
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+      if (line.compare(0, 9, "CLASSIFY ") == 0 || line.compare(0, 5, "DATA ") == 0){
+        shared_ptr<const Classifier> current = atomic_load(&classifier);
+        if (current != model || !session){
+          model = current;
+          session.reset(new ClassifierSession(*model));
+        }
+        session->reset();
+      }
+
+      if (line.compare(0, 9, "CLASSIFY ") == 0){
+        string path = line.substr(9);
+        int file = open(path.c_str(), O_RDONLY);
+        struct stat file_stat;
+        if (file < 0 || fstat(file, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)){
+          if (file >= 0)
+            close(file);
+          out += "{\"path\":" + jsonString(path) + ",\"error\":\"can't be opened\"}\n";
+          continue;
+        }
+        ssize_t file_n;
+        while ((file_n = read(file, &buffer[0], buffer.size())) > 0)
+          session->feed(&buffer[0], file_n);
+        close(file);
+        if (file_n < 0){
+          out += "{\"path\":" + jsonString(path) + ",\"error\":\"can't be read\"}\n";
+          continue;
+        }
+        out += resultString(*model, *session, path);
+        classify_latency.add(elapsedUs(start));
+      } else if (line.compare(0, 5, "DATA ") == 0){
+        data_left = strtoull(line.c_str() + 5, NULL, 10);
+        data_start = start;
+        if (data_left == 0){
+          out += resultString(*model, *session, "");
+          data_latency.add(elapsedUs(data_start));
+        }
+      } else if (line == "STATS"){
+        out += "{\"reloads\":" + to_string(reloads.load()) + ",\"latency_us\":{\"classify\":" + classify_latency.toString() + ",\"data\":" + data_latency.toString() + "}}\n";
+      } else if (line == "RELOAD" || line.compare(0, 7, "RELOAD ") == 0){
+        if (reload(line.size() > 7 ? line.substr(7) : ""))
+          out += "{\"reload\":\"ok\"}\n";
+        else
+          out += "{\"error\":\"the model can't be loaded\"}\n";
+      } else
+        out += "{\"error\":\"unknown request\"}\n";
+    }
+    in.erase(0, pos);
+    if (data_left == 0 && in.size() > max_line_length){
+      out += "{\"error\":\"the request line is too long\"}\n";
+      in.clear();
+      discarding = true;
+    }
+
+    size_t written = 0;
+    while (written < out.size() && (n = write(fd, out.data() + written, out.size() - written)) > 0)
+      written += n;
+    out.clear();
+  }
+  close(fd);
+}
+
+
+/**
+ * @brief Reloads the model every time the daemon receives SIGHUP.
+ */
+void reloadOnSignal(sigset_t signals){
+  int signal;
+  while (sigwait(&signals, &signal) == 0)
+    if (!reload(""))
+      cerr << "The model " << model_path << " can't be loaded" << endl;
+}
+
+
+int main(int argc, char** argv){
+  string socket_path = "fguessd.sock";
+
+  if (argc == 1){
+    cout << "Insert the model file" << endl;
+    return -1;
+  }
+  model_path = argv[1];
+
+  for (int i=2; i < argc;)
+    if (strcmp(argv[i], "-socket") == 0 && i+1 < argc){
+      socket_path = argv[i+1];
+      i+=2;
+    } else {
+      i++;
+    }
+
+  shared_ptr<Classifier> first_classifier(new Classifier);
+  if (!first_classifier->load(model_path)){
+    cerr << "The model " << model_path << " can't be loaded" << endl;
+    return -1;
+  }
+  atomic_store(&classifier, shared_ptr<const Classifier>(first_classifier));
+
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  thread(reloadOnSignal, signals).detach();
+
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)){
+    cerr << "The socket path is too long" << endl;
+    return -1;
+  }
+  strcpy(address.sun_path, socket_path.c_str());
+  // The socket file is only replaced when nothing listens on it: another daemon answering there keeps it
+  int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (probe >= 0 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0){
+    close(probe);
+    cerr << "Another fguessd is already listening on " << socket_path << endl;
+    return -1;
+  }
+  struct stat socket_stat;
+  if (probe >= 0 && errno == ECONNREFUSED && stat(socket_path.c_str(), &socket_stat) == 0 && S_ISSOCK(socket_stat.st_mode))
+    unlink(socket_path.c_str());
+  if (probe >= 0)
+    close(probe);
+  int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server < 0 || bind(server, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(server, 128) != 0){
+    cerr << "The socket " << socket_path << " can't be created" << endl;
+    return -1;
+  }
+  cout << "Listening on " << socket_path << endl;
+
+  int client;
+  while ((client = accept(server, NULL, NULL)) >= 0)
+    thread(serve, client).detach();
+
+  return 0;
+}